@@ -0,0 +1,50 @@
+#!/bin/bash
+
+## Edits
+# Created 10-17-2026
+
+## Usage
+# This script benchmarks the event loop of the BBCAL energy calibration
+# (Combined_macros/bbcal_eng_calib_w_h2.C) w/ different # threads and
+# tabulates the throughput & speedup. Each run uses a copy of the given
+# configfile (<cfg>_bench_nt<N>.cfg, removed afterwards) w/ "nthreads N"
+# and w/o writing/reusing per-run statistics. Example execution:
+#./bench_eng_calib_mt.sh <configfile(relative to macros/)> [nthreads list, default: 1 2 4 8]
+
+# Validating the number of arguments provided
+if [[ "$#" -lt 1 ]]; then
+    echo -e "\n--!--\n Illegal number of arguments!!"
+    echo -e " This script expects at least one argument: <configfile> [nthreads ...] \n"
+    exit;
+fi
+
+# Going to work directory
+cd macros
+
+cfg=$1; shift
+if [[ ! -f $cfg ]]; then
+    echo -e "\n--!--\n Configfile macros/"$cfg" doesn't exist!! \n"
+    exit;
+fi
+nthreads_list=${@:-"1 2 4 8"}
+
+results=""
+for nt in $nthreads_list; do
+    bcfg=${cfg%.cfg}_bench_nt$nt.cfg
+    # drop the keys we set & add them right after the global cut
+    grep -v -E "^(nthreads|write_run_stats|reuse_run_stats)[[:space:]]" $cfg | \
+	sed "/^endcut/a nthreads $nt\nwrite_run_stats 0\nreuse_run_stats 0" > $bcfg
+    echo -e "\n ----=====<< Running w/ $nt thread(s) >>=====---- \n"
+    line=$(root -l -b -q 'Combined_macros/bbcal_eng_calib_w_h2.C("'$bcfg'",1)' 2>&1 | tee /dev/stderr | grep "^Event loop:")
+    rm -f $bcfg
+    results="$results$nt $line\n"
+done
+
+# Event loop: <N> events in <T> s (<R> ev/s) using <n> thread(s)
+echo -e "\n ----=====<< Event loop throughput >>=====---- \n"
+echo -e $results | awk 'NF>0 {
+  nt=$1; t=$7; rate=$9; gsub(/\(/,"",rate);
+  if (t0=="") t0=t;
+  printf " %3d thread(s): %8.1f s  %10.0f ev/s  speedup %5.2f\n", nt, t, rate, (t>0 ? t0/t : 0);
+}'
+echo ""
@@ -0,0 +1,212 @@
+#ifndef BBCAL_BRANCH_USAGE_H
+#define BBCAL_BRANCH_USAGE_H
+/*
+  Branch-usage registry & I/O statistics for the macros reading replayed trees. All branches are
+  switched off first & only the ones declared here are switched on: the variables the macro binds
+  (Bind), the branches the global cut needs (Use(GlobalCut->GetBranches())) & anything else read
+  indirectly (Use). While looping, every tree of the chain is accounted for: # baskets, compressed &
+  uncompressed bytes & entries read per active branch (baskets overlapping the entries read), plus
+  the compressed size touched vs. the size of every file. The numbers come from the basket tables of
+  the trees, so they are what TTreePerfStats would count for a sequential read, but per TChain & w/o
+  global state (one registry per thread). If only some entry ranges are read (sampling), the registry
+  can be given the list of them [see bbcal_event_sampler.h].
+  Usage:
+    BBBranchUsage bu(C);                           // switches all branches off
+    Double_t psE; bu.Bind("bb.ps.e", &psE);
+    bu.Use(GlobalCut->GetBranches());
+    while (C->GetEntry(nevent++)) {
+      if (C->GetTreeNumber() != treenum) bu.Notify(nevent-1);
+      ...
+    }
+    bu.Finish(nevent-1);                           // # entries read
+    bu.Print(std::cout); bu.Write(fname);
+*/
+
+#include <map>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TLeaf.h"
+#include "TChain.h"
+#include "TString.h"
+#include "TBranch.h"
+#include "TObjArray.h"
+
+class BBBranchUsage {
+public:
+  struct BranchIO {
+    Long64_t nbaskets, zipbytes, totbytes, nentries;
+    BranchIO() : nbaskets(0), zipbytes(0), totbytes(0), nentries(0) {}
+  };
+  struct FileIO {
+    TString name;
+    Long64_t filesize, treezipbytes, zipbytes, nentries, nread;
+  };
+
+  BBBranchUsage(TChain *c = 0) : fChain(0), fStart(-1), fOffset(0), fRanges(0) { if (c) SetChain(c); }
+
+  void SetChain(TChain *c) { fChain = c; fChain->SetBranchStatus("*", 0); }
+  // switches on a branch (wildcards allowed, as for SetBranchStatus)
+  void Use(TString const & name) {
+    if (std::find(fNames.begin(), fNames.end(), name) != fNames.end()) return;
+    fNames.push_back(name);
+    fChain->SetBranchStatus(name, 1);
+  }
+  void Use(std::vector<TString> const & names) { for (std::size_t i=0; i<names.size(); i++) Use(names[i]); }
+  template<class T> void Bind(char const * name, T * addr) {
+    Use(name);
+    fChain->SetBranchAddress(name, addr);
+    fBound.push_back(std::make_pair(TString(name), (void*)addr));
+  }
+  std::vector<TString> const & GetBranches() const { return fNames; }
+  std::vector<std::pair<TString, void*> > const & GetBound() const { return fBound; }   // branches & buffers of Bind
+  // chain entry ranges [first, end) read, instead of everything from the 1st entry read in a tree on (0: that)
+  void SetReadRanges(std::vector<std::pair<Long64_t, Long64_t> > const * ranges) { fRanges = ranges; }
+
+  // to be called when the chain has loaded a new tree, w/ the (chain) entry just read
+  void Notify(Long64_t entry) {
+    Close(entry);
+    TTree *T = fChain->GetTree();
+    if (!T) return;
+    fStart = entry;
+    fOffset = T->GetChainOffset();
+    fCurrent = Pending();
+    TFile *f = T->GetCurrentFile();
+    fCurrent.file.name = f ? f->GetName() : "";
+    fCurrent.file.filesize = f ? f->GetSize() : 0;
+    fCurrent.file.treezipbytes = T->GetZipBytes();
+    fCurrent.file.nentries = T->GetEntries();
+    // active branches & their basket tables (the tree is gone by the time we know how much of it was read)
+    TObjArray *leaves = T->GetListOfLeaves();
+    for (Int_t i=0; i<leaves->GetEntriesFast(); i++) {
+      TBranch *br = ((TLeaf*)leaves->UncheckedAt(i))->GetBranch();
+      if (br->TestBit(kDoNotProcess) || fCurrent.branches.count(br->GetName())) continue;
+      Baskets & b = fCurrent.branches[br->GetName()];
+      Int_t nb = br->GetWriteBasket();
+      b.first.assign(br->GetBasketEntry(), br->GetBasketEntry() + nb);
+      b.bytes.assign(br->GetBasketBytes(), br->GetBasketBytes() + nb);
+      b.zipbytes = br->GetZipBytes(); b.totbytes = br->GetTotBytes(); b.nentries = br->GetEntries();
+    }
+  }
+  // to be called after the loop w/ the total # (chain) entries read
+  void Finish(Long64_t nread) { Close(nread); }
+
+  // sums the statistics of another registry (e.g. of another thread)
+  void Add(BBBranchUsage const & o) {
+    for (std::map<TString, BranchIO>::const_iterator it = o.fBranchIO.begin(); it != o.fBranchIO.end(); ++it) {
+      BranchIO & b = fBranchIO[it->first];
+      b.nbaskets += it->second.nbaskets; b.zipbytes += it->second.zipbytes;
+      b.totbytes += it->second.totbytes; b.nentries += it->second.nentries;
+    }
+    fFiles.insert(fFiles.end(), o.fFiles.begin(), o.fFiles.end());
+    for (std::size_t i=0; i<o.fNames.size(); i++)
+      if (std::find(fNames.begin(), fNames.end(), o.fNames[i]) == fNames.end()) fNames.push_back(o.fNames[i]);
+  }
+
+  Long64_t GetZipBytesRead() const {
+    Long64_t n = 0;
+    for (std::size_t i=0; i<fFiles.size(); i++) n += fFiles[i].zipbytes;
+    return n;
+  }
+  Long64_t GetFileBytes() const {
+    Long64_t n = 0;
+    for (std::size_t i=0; i<fFiles.size(); i++) n += fFiles[i].filesize;
+    return n;
+  }
+
+  void Print(std::ostream & out) const {
+    out << Form("I/O: %d active branches, %.1f MB (compressed) touched in %d file(s) of %.1f MB (%.1f%%)",
+		Int_t(fBranchIO.size()), GetZipBytesRead()/1e6, Int_t(fFiles.size()), GetFileBytes()/1e6,
+		100.*GetZipBytesRead()/std::max(GetFileBytes(), Long64_t(1))) << "\n";
+  }
+  bool Write(TString const & fname) const {
+    std::ofstream out(fname.Data());
+    if (!out.is_open()) {
+      std::cerr << "*!*[WARNING] Could not write I/O statistics to " << fname << "\n";
+      return false;
+    }
+    out << "# I/O statistics per branch (baskets overlapping the entries read)\n";
+    out << "# branch nbaskets zipMB totMB nentries\n";
+    std::vector<std::pair<Long64_t, TString> > order;   // largest first
+    for (std::map<TString, BranchIO>::const_iterator it = fBranchIO.begin(); it != fBranchIO.end(); ++it)
+      order.push_back(std::make_pair(-it->second.zipbytes, it->first));
+    std::sort(order.begin(), order.end());
+    for (std::size_t i=0; i<order.size(); i++) {
+      BranchIO const & b = fBranchIO.find(order[i].second)->second;
+      out << Form("%-40s %8lld %10.3f %10.3f %12lld", order[i].second.Data(), b.nbaskets, b.zipbytes/1e6, b.totbytes/1e6, b.nentries) << "\n";
+    }
+    out << "# I/O statistics per file\n";
+    out << "# file nread/nentries touchedMB treeMB fileMB touched/file(%)\n";
+    for (std::size_t i=0; i<fFiles.size(); i++) {
+      FileIO const & f = fFiles[i];
+      out << Form("%s %lld/%lld %.3f %.3f %.3f %.2f", f.name.Data(), f.nread, f.nentries, f.zipbytes/1e6, f.treezipbytes/1e6,
+		  f.filesize/1e6, 100.*f.zipbytes/std::max(f.filesize, Long64_t(1))) << "\n";
+    }
+    out << "# switched on: ";
+    for (std::size_t i=0; i<fNames.size(); i++) out << fNames[i] << " ";
+    out << "\n";
+    return out.good();
+  }
+
+private:
+  struct Baskets {
+    std::vector<Long64_t> first;  // 1st entry of every basket
+    std::vector<Int_t> bytes;     // compressed size of every basket
+    Long64_t zipbytes, totbytes, nentries;
+  };
+  struct Pending {
+    FileIO file;
+    std::map<TString, Baskets> branches;
+  };
+
+  TChain *fChain;
+  std::vector<TString> fNames;
+  std::vector<std::pair<TString, void*> > fBound;
+  std::map<TString, BranchIO> fBranchIO;
+  std::vector<FileIO> fFiles;
+  Pending fCurrent;
+  Long64_t fStart;                // chain entry at which the current tree was entered
+  Long64_t fOffset;               // chain entry of the 1st entry of the current tree
+  std::vector<std::pair<Long64_t, Long64_t> > const * fRanges;
+
+  // accounts the current tree, read up to (excluding) the given chain entry
+  void Close(Long64_t entry) {
+    if (fStart < 0) return;
+    // tree entry ranges read
+    std::vector<std::pair<Long64_t, Long64_t> > read;
+    Long64_t nread = 0;
+    if (!fRanges) read.push_back(std::make_pair(Long64_t(0), std::min(std::max(entry - fStart, Long64_t(0)), fCurrent.file.nentries)));
+    for (std::size_t i=0; fRanges && i<fRanges->size(); i++) {
+      Long64_t first = std::max((*fRanges)[i].first - fOffset, Long64_t(0));
+      Long64_t end = std::min((*fRanges)[i].second - fOffset, fCurrent.file.nentries);
+      if (first < end) read.push_back(std::make_pair(first, end));
+    }
+    for (std::size_t i=0; i<read.size(); i++) nread += read[i].second - read[i].first;
+    fCurrent.file.nread = nread;
+    fCurrent.file.zipbytes = 0;
+    for (std::map<TString, Baskets>::iterator it = fCurrent.branches.begin(); it != fCurrent.branches.end(); ++it) {
+      Baskets const & b = it->second;
+      BranchIO & io = fBranchIO[it->first];
+      Long64_t zip = 0; Int_t nb = 0;
+      for (std::size_t k=0; k<b.first.size(); k++) {
+	Long64_t bend = k+1 < b.first.size() ? b.first[k+1] : b.nentries;
+	bool overlap = false;
+	for (std::size_t i=0; i<read.size() && !overlap; i++) overlap = b.first[k] < read[i].second && read[i].first < bend;
+	if (overlap) { zip += b.bytes[k]; nb++; }
+      }
+      io.nbaskets += nb;
+      io.zipbytes += zip;
+      io.totbytes += b.zipbytes > 0 ? Long64_t(double(b.totbytes) * zip / b.zipbytes) : 0;
+      io.nentries += std::min(nread, b.nentries);
+      fCurrent.file.zipbytes += zip;
+    }
+    fFiles.push_back(fCurrent.file);
+    fStart = -1;
+  }
+};
+
+#endif
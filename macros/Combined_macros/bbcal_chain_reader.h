@@ -0,0 +1,168 @@
+#ifndef BBCAL_CHAIN_READER_H
+#define BBCAL_CHAIN_READER_H
+/*
+  Read tuning of a TChain of replayed files. W/ default settings ROOT sizes the TTreeCache of every
+  file from all its branches, learns the branches to cache from the first entries (reading each of
+  them on its own meanwhile) & opens the next file only when the loop reaches it. Here:
+    - the cache holds the active branches only (the ones switched on, e.g. by BBBranchUsage &
+      BBGlobalCut), w/o learning phase, & is sized to one cluster of them (or a given size)
+    - baskets can be unzipped in parallel by the cache (TTreeCacheUnzip, needs ROOT::EnableImplicitMT)
+    - while a file is read, a background thread opens the next one of the chain & reads the baskets of
+      the active branches into a scratch buffer (up to a given size), so the file's header, directory
+      & data are in the OS page cache when the chain opens it. Run lists of many small segment files
+      spend most of their wall time in file open & first-basket latency otherwise.
+  ROOT::EnableThreadSafety() must be called before using the prefetch. One reader per chain (thread).
+  Usage:
+    BBChainReader reader;
+    ... switch on & bind the branches ...
+    reader.Setup(C, 0., false, 256.);              // auto-sized cache, serial unzip, prefetch up to 256 MB
+    while (C->GetEntry(nevent++)) {
+      if (C->GetTreeNumber() != treenum) reader.Notify();
+      ...
+    }
+    reader.Wait();
+    reader.Print(std::cout);
+*/
+
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TLeaf.h"
+#include "TChain.h"
+#include "TString.h"
+#include "TBranch.h"
+#include "TObjArray.h"
+
+class BBChainReader {
+public:
+  BBChainReader() : fChain(0), fCacheBytes(0), fPrefetchBytes(0), fNext(-1), fUnzip(false),
+		    fNprefetched(0), fBytesPrefetched(0), fWaitTime(0.) {}
+  ~BBChainReader() { Wait(); }
+
+  // cacheMB: TTreeCache size (0: one cluster of the active branches, < 0: ROOT default),
+  // prefetchMB: max. # MB of the next file read ahead (0: no prefetch). Call after the branches are switched on.
+  void Setup(TChain *C, Double_t cacheMB, bool unzip, Double_t prefetchMB) {
+    fChain = C;
+    fUnzip = unzip;
+    fPrefetchBytes = Long64_t(prefetchMB*1024*1024);
+    if (C->LoadTree(0) < 0 || !C->GetTree()) return;
+    std::vector<TBranch*> active = GetActiveBranches(C->GetTree());
+    if (unzip) C->SetParallelUnzip(kTRUE);
+    if (cacheMB >= 0.) {
+      fCacheBytes = cacheMB > 0. ? Long64_t(cacheMB*1024*1024) : GetClusterBytes(C->GetTree(), active);
+      C->SetCacheSize(fCacheBytes);
+      for (std::size_t i=0; i<active.size(); i++) C->AddBranchToCache(active[i]->GetName(), kFALSE);
+      C->StopCacheLearningPhase();
+    }
+    Notify();
+  }
+  // to be called when the chain has loaded a new tree: waits for its prefetch & starts the one of the next file
+  void Notify() {
+    if (fPrefetchBytes <= 0 || !fChain || !fChain->GetTree()) return;
+    Int_t next = fChain->GetTreeNumber() + 1;
+    if (next == fNext) return;   // same tree as before
+    Wait();
+    if (next >= fChain->GetListOfFiles()->GetEntries()) return;
+    fNext = next;
+    std::vector<TString> names;
+    std::vector<TBranch*> active = GetActiveBranches(fChain->GetTree());
+    for (std::size_t i=0; i<active.size(); i++) names.push_back(active[i]->GetName());
+    fThread = std::thread(&BBChainReader::Prefetch, this, TString(fChain->GetListOfFiles()->At(next)->GetTitle()),
+			  TString(fChain->GetName()), names);
+  }
+  // waits for the prefetch running (if any)
+  void Wait() {
+    if (!fThread.joinable()) return;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    fThread.join();
+    fWaitTime += std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - t0).count();
+  }
+
+  Long64_t GetCacheBytes() const { return fCacheBytes; }
+  Int_t GetNprefetched() const { return fNprefetched; }
+  Long64_t GetBytesPrefetched() const { return fBytesPrefetched; }
+  Double_t GetWaitTime() const { return fWaitTime; }   // s the loop waited for a prefetch to finish
+
+  // sums the statistics of another reader (e.g. of another thread)
+  void Add(BBChainReader const & o) {
+    fCacheBytes += o.fCacheBytes; fNprefetched += o.fNprefetched;
+    fBytesPrefetched += o.fBytesPrefetched; fWaitTime += o.fWaitTime;
+    fUnzip = fUnzip || o.fUnzip; fPrefetchBytes = std::max(fPrefetchBytes, o.fPrefetchBytes);
+  }
+  void Print(std::ostream & out) const {
+    out << Form("Read: %.1f MB tree cache(s), %s unzip, %d file(s) prefetched (%.1f MB), %.1f s waited for prefetch",
+		fCacheBytes/1048576., fUnzip ? "parallel" : "serial", fNprefetched, fBytesPrefetched/1048576., fWaitTime) << "\n";
+  }
+
+private:
+  TChain *fChain;
+  Long64_t fCacheBytes, fPrefetchBytes;
+  Int_t fNext;                    // tree # of the last prefetch started
+  bool fUnzip;
+  Int_t fNprefetched;
+  Long64_t fBytesPrefetched;
+  Double_t fWaitTime;
+  std::thread fThread;
+
+  static std::vector<TBranch*> GetActiveBranches(TTree *T) {
+    std::vector<TBranch*> active;
+    TObjArray *leaves = T->GetListOfLeaves();
+    for (Int_t i=0; i<leaves->GetEntriesFast(); i++) {
+      TBranch *br = ((TLeaf*)leaves->UncheckedAt(i))->GetBranch();
+      if (br->TestBit(kDoNotProcess) || std::find(active.begin(), active.end(), br) != active.end()) continue;
+      active.push_back(br);
+    }
+    return active;
+  }
+  // compressed size of one cluster of the active branches (+10%), between 4 & 256 MB
+  static Long64_t GetClusterBytes(TTree *T, std::vector<TBranch*> const & active) {
+    Long64_t nentries = std::max(T->GetEntries(), Long64_t(1));
+    Long64_t zip = 0;
+    for (std::size_t i=0; i<active.size(); i++) zip += active[i]->GetZipBytes();
+    Long64_t cluster = T->GetAutoFlush() > 0 ? std::min(T->GetAutoFlush(), nentries) : nentries;
+    Long64_t bytes = Long64_t(1.1 * zip * cluster / nentries);
+    return std::min(std::max(bytes, Long64_t(4)*1024*1024), Long64_t(256)*1024*1024);
+  }
+  // runs in the background: opens the file & reads the baskets of the given branches in file order
+  void Prefetch(TString fname, TString treename, std::vector<TString> names) {
+    TFile *f = TFile::Open(fname, "READ");
+    if (!f || f->IsZombie()) { delete f; return; }
+    TTree *T = 0;
+    f->GetObject(treename, T);
+    std::vector<std::pair<Long64_t, Int_t> > baskets;   // seek, bytes
+    for (std::size_t i=0; T && i<names.size(); i++) {
+      TBranch *br = T->GetBranch(names[i]);
+      if (!br) continue;
+      for (Int_t k=0; k<br->GetWriteBasket(); k++)
+	if (br->GetBasketSeek(k) > 0) baskets.push_back(std::make_pair(br->GetBasketSeek(k), br->GetBasketBytes()[k]));
+    }
+    std::sort(baskets.begin(), baskets.end());
+    // in chunks of <= 16 MB, up to the prefetch size
+    Long64_t nread = 0;
+    std::vector<char> buf;
+    std::vector<Long64_t> pos;
+    std::vector<Int_t> len;
+    for (std::size_t k=0; k<baskets.size() && nread < fPrefetchBytes; ) {
+      pos.clear(); len.clear();
+      Long64_t chunk = 0;
+      for (; k<baskets.size() && (chunk == 0 || chunk + baskets[k].second <= 16*1024*1024) && nread + chunk < fPrefetchBytes; k++) {
+	pos.push_back(baskets[k].first); len.push_back(baskets[k].second);
+	chunk += baskets[k].second;
+      }
+      buf.resize(chunk);
+      if (f->ReadBuffers(&buf[0], &pos[0], &len[0], pos.size())) break;
+      nread += chunk;
+    }
+    delete T;
+    f->Close(); delete f;
+    fNprefetched++;
+    fBytesPrefetched += nread;
+  }
+};
+
+#endif
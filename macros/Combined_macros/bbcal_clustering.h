@@ -0,0 +1,158 @@
+#ifndef BBCAL_CLUSTERING_H
+#define BBCAL_CLUSTERING_H
+/*
+  Re-clustering of the BBCAL (SH: 27x7, PS: 26x2) from the block-level "goodblock" branches of the
+  replayed tree, w/ the clustering cuts of the calibration instead of the ones used during replay.
+  Clusters are built in a single pass: blocks passing the hit threshold are taken in decreasing
+  energy order, every block not yet used seeds a cluster & collects the unused neighbours (from a
+  neighbour table precomputed for the grid, +/- nclubr rows & +/- nclubc cols) which pass the
+  time & energy fraction cuts w.r.t. the seed. The hits are kept in fixed-capacity per-event
+  buffers (one slot per block), so nothing gets allocated in the event loop.
+  Time cuts are w.r.t. the seed of the cluster, or w.r.t. an external reference if one is given
+  (e.g. the PS blocks are compared to the seed of the best SH cluster, as in the calibration).
+  Usage:
+    BBCalClusterer sh(kNrowsSH, kNcolsSH);
+    sh.SetCuts(sh_hit_threshold, sh_tmax_cut, sh_engFrac_cut);
+    sh.Bind(bu, "bb.sh");                   // Ndata.bb.sh.goodblock.* & bb.sh.goodblock.*
+    ...
+    sh.Find();                              // per event
+    Int_t ic = sh.ClusterOf(shIdblk);       // cluster containing a given block (or Best())
+    ... sh.GetE(ic), sh.GetNblk(ic), sh.GetBlk(ic, k) (k=0 is the seed) ...
+*/
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "TString.h"
+
+class BBCalClusterer {
+public:
+  static constexpr Double_t kNoTimeRef = -1e38;
+
+  // block-level input (one slot per block), filled by the tree
+  Int_t nhit;
+  std::vector<Double_t> e, x, y, atime, row, col, id;
+
+  BBCalClusterer(Int_t nrows, Int_t ncols, Int_t nclubr = 1, Int_t nclubc = 1)
+    : nhit(0), fNrows(nrows), fNcols(ncols), fThr(0.), fTmax(1e38), fEngFrac(0.), fNclus(0), fEvent(0)
+  {
+    Int_t nblk = nrows*ncols;
+    std::vector<Double_t> * arrs[] = {&e, &x, &y, &atime, &row, &col, &id};
+    for (std::size_t i=0; i<sizeof(arrs)/sizeof(arrs[0]); i++) arrs[i]->assign(nblk, 0.);
+    // neighbour table (CSR): cells within the clustering window of every cell, itself excluded
+    fNbFirst.assign(nblk+1, 0);
+    for (Int_t r=0; r<nrows; r++) {
+      for (Int_t c=0; c<ncols; c++) {
+	for (Int_t rr=std::max(0, r-nclubr); rr<=std::min(nrows-1, r+nclubr); rr++)
+	  for (Int_t cc=std::max(0, c-nclubc); cc<=std::min(ncols-1, c+nclubc); cc++)
+	    if (rr != r || cc != c) fNb.push_back(rr*ncols + cc);
+	fNbFirst[r*ncols + c + 1] = fNb.size();
+      }
+    }
+    fSlot.assign(nblk, -1); fStamp.assign(nblk, 0);
+    fOrder.assign(nblk, 0); fHitClus.assign(nblk, -1); fMembers.assign(nblk, 0);
+    fCluFirst.assign(nblk+1, 0);
+    std::vector<Double_t> * carrs[] = {&fCluE, &fCluX, &fCluY};
+    for (std::size_t i=0; i<sizeof(carrs)/sizeof(carrs[0]); i++) carrs[i]->assign(nblk, 0.);
+  }
+
+  void SetCuts(Double_t hit_threshold, Double_t tmax, Double_t engFrac) { fThr = hit_threshold; fTmax = tmax; fEngFrac = engFrac; }
+
+  // switches on & binds the goodblock branches of the detector (e.g. "bb.sh") through a branch registry
+  template<class R> void Bind(R & bu, TString const & det) {
+    bu.Bind(Form("Ndata.%s.goodblock.e", det.Data()), &nhit);
+    bu.Bind(Form("%s.goodblock.e", det.Data()), &e[0]);
+    bu.Bind(Form("%s.goodblock.x", det.Data()), &x[0]);
+    bu.Bind(Form("%s.goodblock.y", det.Data()), &y[0]);
+    bu.Bind(Form("%s.goodblock.atime", det.Data()), &atime[0]);
+    bu.Bind(Form("%s.goodblock.row", det.Data()), &row[0]);
+    bu.Bind(Form("%s.goodblock.col", det.Data()), &col[0]);
+    bu.Bind(Form("%s.goodblock.id", det.Data()), &id[0]);
+  }
+
+  // builds all the clusters of the event, returns their #
+  Int_t Find(Double_t tref = kNoTimeRef) {
+    Int_t n = std::max(0, std::min(nhit, Int_t(e.size())));
+    bool exttime = tref != kNoTimeRef;
+    fEvent++;
+    fNclus = 0;
+    // blocks passing the hit cuts, sorted by decreasing energy (insertion sort, n is small)
+    Int_t ngood = 0;
+    for (Int_t i=0; i<n; i++) {
+      fHitClus[i] = -1;
+      if (e[i] <= fThr) continue;
+      if (exttime && std::fabs(atime[i] - tref) >= fTmax) continue;
+      Int_t cell = Int_t(row[i])*fNcols + Int_t(col[i]);
+      if (cell < 0 || cell >= Int_t(fSlot.size())) continue;
+      fSlot[cell] = i; fStamp[cell] = fEvent;
+      Int_t k = ngood++;
+      while (k > 0 && e[fOrder[k-1]] < e[i]) { fOrder[k] = fOrder[k-1]; k--; }
+      fOrder[k] = i;
+    }
+    Int_t nmem = 0;
+    for (Int_t io=0; io<ngood; io++) {
+      Int_t seed = fOrder[io];
+      if (fHitClus[seed] >= 0) continue;
+      Int_t ic = fNclus++;
+      fCluFirst[ic] = nmem;
+      fMembers[nmem++] = seed; fHitClus[seed] = ic;
+      Double_t t0 = exttime ? tref : atime[seed];
+      Int_t cell = Int_t(row[seed])*fNcols + Int_t(col[seed]);
+      for (Int_t in=fNbFirst[cell]; in<fNbFirst[cell+1]; in++) {
+	Int_t nb = fNb[in];
+	if (fStamp[nb] != fEvent) continue;
+	Int_t h = fSlot[nb];
+	if (fHitClus[h] >= 0) continue;
+	if (std::fabs(atime[h] - t0) >= fTmax || e[h]/e[seed] < fEngFrac) continue;
+	// keep the members in decreasing energy order (seed first)
+	Int_t k = nmem++;
+	while (k > fCluFirst[ic]+1 && e[fMembers[k-1]] < e[h]) { fMembers[k] = fMembers[k-1]; k--; }
+	fMembers[k] = h; fHitClus[h] = ic;
+      }
+      fCluFirst[ic+1] = nmem;
+      // energy & energy weighted position
+      Double_t esum = 0., xsum = 0., ysum = 0.;
+      for (Int_t k=fCluFirst[ic]; k<nmem; k++) {
+	Int_t h = fMembers[k];
+	esum += e[h]; xsum += e[h]*x[h]; ysum += e[h]*y[h];
+      }
+      fCluE[ic] = esum; fCluX[ic] = xsum/esum; fCluY[ic] = ysum/esum;
+    }
+    return fNclus;
+  }
+
+  Int_t GetNclus() const { return fNclus; }
+  // cluster w/ the highest energy (-1 if none)
+  Int_t Best() const {
+    Int_t ib = -1;
+    for (Int_t ic=0; ic<fNclus; ic++) if (ib < 0 || fCluE[ic] > fCluE[ib]) ib = ic;
+    return ib;
+  }
+  // cluster containing the block w/ the given id (-1 if the block was not clustered)
+  Int_t ClusterOf(Double_t blkid) const {
+    Int_t n = std::max(0, std::min(nhit, Int_t(e.size())));
+    for (Int_t i=0; i<n; i++) if (id[i] == blkid) return fHitClus[i];
+    return -1;
+  }
+  Double_t GetE(Int_t ic) const { return fCluE[ic]; }
+  Double_t GetX(Int_t ic) const { return fCluX[ic]; }
+  Double_t GetY(Int_t ic) const { return fCluY[ic]; }
+  Int_t GetNblk(Int_t ic) const { return fCluFirst[ic+1] - fCluFirst[ic]; }
+  // hit index (into the input arrays) of the k-th block of the cluster, k=0: seed
+  Int_t GetBlk(Int_t ic, Int_t k) const { return fMembers[fCluFirst[ic] + k]; }
+
+private:
+  Int_t fNrows, fNcols;
+  Double_t fThr, fTmax, fEngFrac;
+  std::vector<Int_t> fNb, fNbFirst;         // neighbour table
+  std::vector<Int_t> fSlot;                 // cell -> hit index, valid if fStamp == fEvent
+  std::vector<Long64_t> fStamp;
+  std::vector<Int_t> fOrder, fHitClus;      // hits by decreasing energy, hit -> cluster
+  Int_t fNclus;
+  std::vector<Int_t> fMembers, fCluFirst;   // hits of every cluster (CSR)
+  std::vector<Double_t> fCluE, fCluX, fCluY;
+  Long64_t fEvent;
+};
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef BBCAL_EVENT_SAMPLER_H
+#define BBCAL_EVENT_SAMPLER_H
+/*
+  Stratified quick-look sampling of a TChain of replayed files. Instead of every entry, each file is read
+  cluster by cluster (the entry ranges ROOT compresses together, so skipped baskets are never read nor
+  unzipped) in a spread order (bit-reversed cluster index: 1st, middle, quarters, ...), until the file
+  has given its share of
+    - nrun accepted events per run (shared among the files of a run by their # entries), and
+    - nregion accepted events per SH & per PS block (seed block of the cluster), over the whole job
+      (shared among all files by their # entries)
+  or maxfrac of its entries have been read. Blocks w/o any event so far don't hold a file back, so dead
+  or unreachable blocks cost nothing; rare (e.g. edge) blocks make files read further, up to maxfrac.
+  The macro tells the sampler which events it accepted & a value per event (e.g. E/p, ADC time offset);
+  the precision reached per block (error of the mean of that value) is printed & written at the end.
+  The entries read are recorded, so a 2nd loop can read exactly the same ones (Rewind). W/o Setup the
+  sampler just counts 0, 1, 2, ... (the loop stops when GetEntry fails).
+  Usage:
+    BBEventSampler sampler;
+    sampler.Setup(C, 2000, 50, 0.2);                       // or Setup(C, BBEventSampler::MakeQuotas(...), 0.2)
+    Long64_t entry;
+    while (C->GetEntry(entry = sampler.Next())) {
+      ...
+      if (accepted) sampler.Count(shIdblk, psIdblk, EovP, EovP);
+    }
+    sampler.Print(std::cout);
+    sampler.PrintPrecision(std::cout, "E/p");
+    sampler.Write(fname, "E/p");
+*/
+
+#include <map>
+#include <cmath>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "TTree.h"
+#include "TChain.h"
+#include "TString.h"
+#include "TObjArray.h"
+#include "calib_run_stats.h"
+
+// # entries & quotas (accepted events in total & per block) of a file
+struct BBSampleFile {
+  Long64_t nentries;
+  Double_t nrun, nregion;
+};
+
+class BBEventSampler {
+public:
+  enum { kNsh = 189, kNps = 52 };   // SH & PS blocks (regions)
+
+  BBEventSampler() : fOn(false), fReplay(false), fMaxFrac(1.), fChain(0), fEntry(0), fFile(-1), fClus(0),
+		     fCur(0), fEnd(0), fFileRead(0), fFileAcc(0), fNread(0), fNentries(0), fNacc(0),
+		     fNclusRead(0), fNclus(0), fNcapped(0), fIreplay(0),
+		     fN(kNsh+kNps, 0), fSum(kNsh+kNps, 0.), fSum2(kNsh+kNps, 0.), fFileN(kNsh+kNps, 0) {}
+
+  // quotas of the files of a job from their run numbers & # entries
+  static std::vector<BBSampleFile> MakeQuotas(std::vector<UInt_t> const & runs, std::vector<Long64_t> const & nentries,
+					      Long64_t nrun, Long64_t nregion) {
+    std::map<UInt_t, Long64_t> nperrun;
+    Long64_t ntot = 0;
+    for (std::size_t i=0; i<runs.size(); i++) { nperrun[runs[i]] += nentries[i]; ntot += nentries[i]; }
+    std::vector<BBSampleFile> files(runs.size());
+    for (std::size_t i=0; i<runs.size(); i++) {
+      files[i].nentries = nentries[i];
+      files[i].nrun = nperrun[runs[i]] > 0 ? Double_t(nrun)*nentries[i]/nperrun[runs[i]] : 0.;
+      files[i].nregion = ntot > 0 ? Double_t(nregion)*nentries[i]/ntot : 0.;
+    }
+    return files;
+  }
+
+  // scans the files of C for their run numbers & # entries (nrun = nregion = 0: no sampling)
+  void Setup(TChain *C, Long64_t nrun, Long64_t nregion, Double_t maxfrac) {
+    if (nrun <= 0 && nregion <= 0) return;
+    std::vector<UInt_t> runs;
+    std::vector<Long64_t> nentries;
+    TObjArray *fl = C->GetListOfFiles();
+    for (Int_t i=0; i<fl->GetEntries(); i++) {
+      Long64_t n = 0;
+      runs.push_back(GetFileRunNumber(fl->At(i)->GetTitle(), &n));
+      nentries.push_back(n);
+    }
+    Setup(C, MakeQuotas(runs, nentries, nrun, nregion), maxfrac);
+  }
+  // files: one per file of C, in the order of C
+  void Setup(TChain *C, std::vector<BBSampleFile> const & files, Double_t maxfrac) {
+    fOn = true;
+    fChain = C;
+    fFiles = files;
+    fMaxFrac = maxfrac > 0. && maxfrac < 1. ? maxfrac : 1.;
+    fOffset.assign(1, 0);
+    for (std::size_t i=0; i<files.size(); i++) fOffset.push_back(fOffset.back() + files[i].nentries);
+    fNentries = fOffset.back();
+  }
+  bool IsOn() const { return fOn; }
+
+  // the next chain entry to read (-1: no more)
+  Long64_t Next() {
+    if (!fOn) return fEntry++;
+    if (fReplay) {
+      while (fIreplay < fRead.size() && fCur >= fRead[fIreplay].second)
+	if (++fIreplay < fRead.size()) fCur = fRead[fIreplay].first;
+      return fIreplay < fRead.size() ? fCur++ : -1;
+    }
+    while (fCur >= fEnd) {
+      // cluster done: the next one of the file, or the next file
+      if (fFile >= 0 && fClus+1 < fClusters.size()) {
+	bool quota = QuotaDone();
+	if (!quota && fFileRead < fMaxFrac*fFiles[fFile].nentries) { SetCluster(fClus+1); continue; }
+	if (!quota) fNcapped++;
+      }
+      if (!NextFile()) return -1;
+    }
+    fNread++; fFileRead++;
+    return fCur++;
+  }
+  // an accepted event: seed blocks (< 0: none) & the values whose precision is reported
+  void Count(Int_t shblk, Int_t psblk, Double_t xsh, Double_t xps) {
+    if (fReplay) return;
+    fNacc++; fFileAcc++;
+    if (shblk >= 0 && shblk < kNsh) Fill(shblk, xsh);
+    if (psblk >= 0 && psblk < kNps) Fill(kNsh+psblk, xps);
+  }
+  // the next loop reads the same entries again
+  void Rewind() {
+    fEntry = 0;
+    fReplay = fOn;
+    fIreplay = 0;
+    fCur = fRead.empty() ? 0 : fRead[0].first;
+  }
+
+  Long64_t GetNread() const { return fNread; }
+  std::vector<std::pair<Long64_t, Long64_t> > const & GetReadRanges() const { return fRead; }   // chain entries [first, end)
+  Long64_t GetNaccepted() const { return fNacc; }
+  Long64_t GetN(Int_t region) const { return fN[region]; }   // region: SH block, kNsh + PS block
+  Double_t GetMean(Int_t region) const { return fN[region] > 0 ? fSum[region]/fN[region] : 0.; }
+  Double_t GetError(Int_t region) const {   // error of the mean
+    if (fN[region] < 2) return 0.;
+    Double_t m = GetMean(region);
+    return sqrt(std::max(fSum2[region]/fN[region] - m*m, 0.)/(fN[region]-1));
+  }
+
+  // sums the statistics of another sampler (e.g. of another thread)
+  void Add(BBEventSampler const & o) {
+    fOn = fOn || o.fOn;
+    fNread += o.fNread; fNentries += o.fNentries; fNacc += o.fNacc;
+    fNclusRead += o.fNclusRead; fNclus += o.fNclus; fNcapped += o.fNcapped;
+    for (std::size_t r=0; r<fN.size(); r++) { fN[r] += o.fN[r]; fSum[r] += o.fSum[r]; fSum2[r] += o.fSum2[r]; }
+  }
+  void Print(std::ostream & out) const {
+    if (!fOn) return;
+    out << Form("Sampling: %lld of %lld entries read (%.1f%%) in %lld of %lld clusters, %lld accepted event(s), "
+		"%lld file(s) stopped at the max. fraction (%.0f%%)", fNread, fNentries, fNentries > 0 ? 100.*fNread/fNentries : 0.,
+		fNclusRead, fNclus, fNacc, fNcapped, 100.*fMaxFrac) << "\n";
+  }
+  // median & worst error of the mean per block, # blocks w/ events & w/ fewer than nmin
+  void PrintPrecision(std::ostream & out, char const * label, Long64_t nmin = 0) const {
+    if (!fOn) return;
+    for (Int_t det=0; det<2; det++) {
+      Int_t first = det == 0 ? 0 : kNsh, n = det == 0 ? kNsh : kNps;
+      std::vector<Double_t> err;
+      Int_t worst = -1, nlow = 0;
+      for (Int_t r=first; r<first+n; r++) {
+	if (fN[r] == 0) continue;
+	if (fN[r] < nmin) nlow++;
+	err.push_back(GetError(r));
+	if (worst < 0 || GetError(r) > GetError(worst)) worst = r;
+      }
+      if (err.empty()) { out << Form(" %s: no events", det == 0 ? "SH" : "PS") << "\n"; continue; }
+      std::nth_element(err.begin(), err.begin() + err.size()/2, err.end());
+      out << Form(" %s %s per block: error of the mean %.3g (median), %.3g (worst, block %d w/ %lld events), "
+		  "%d of %d blocks w/ events, %d w/ fewer than %lld", det == 0 ? "SH" : "PS", label, err[err.size()/2],
+		  GetError(worst), worst-first, fN[worst], Int_t(err.size()), n, nlow, nmin) << "\n";
+    }
+  }
+  // per block: # events, mean, rms & error of the mean of the value (+ an extra column per cell, if given)
+  void Write(TString const & fname, char const * label, std::vector<Double_t> const & extra = std::vector<Double_t>(),
+	     char const * extraLabel = "") const {
+    std::ofstream out(fname.Data());
+    out << "# det block nevents mean(" << label << ") rms error_of_mean" << (extra.empty() ? "" : " ") << extraLabel << "\n";
+    for (Int_t r=0; r<kNsh+kNps; r++) {
+      Double_t m = GetMean(r);
+      Double_t rms = fN[r] > 0 ? sqrt(std::max(fSum2[r]/fN[r] - m*m, 0.)) : 0.;
+      out << (r < kNsh ? "SH " : "PS ") << (r < kNsh ? r : r-kNsh) << " " << fN[r] << " " << m << " " << rms << " " << GetError(r);
+      if (r < Int_t(extra.size())) out << " " << extra[r];
+      out << "\n";
+    }
+  }
+
+private:
+  bool fOn, fReplay;
+  Double_t fMaxFrac;
+  TChain *fChain;
+  Long64_t fEntry;                  // w/o sampling
+  std::vector<BBSampleFile> fFiles;
+  std::vector<Long64_t> fOffset;    // 1st chain entry of every file, plus the end
+  Int_t fFile;                      // current file
+  std::vector<std::pair<Long64_t, Long64_t> > fClusters;   // of the current file, chain entries [first, end), in reading order
+  std::size_t fClus;
+  Long64_t fCur, fEnd;              // next entry & end of the current cluster
+  Long64_t fFileRead, fFileAcc;
+  Long64_t fNread, fNentries, fNacc, fNclusRead, fNclus, fNcapped;
+  std::vector<std::pair<Long64_t, Long64_t> > fRead;       // entry ranges read, for Rewind
+  std::size_t fIreplay;
+  std::vector<Long64_t> fN;         // per region: accepted events (job), value sums
+  std::vector<Double_t> fSum, fSum2;
+  std::vector<Long64_t> fFileN;     // per region: accepted events (current file)
+
+  void Fill(Int_t r, Double_t x) { fN[r]++; fSum[r] += x; fSum2[r] += x*x; fFileN[r]++; }
+
+  // the current file gave its share
+  bool QuotaDone() const {
+    BBSampleFile const & f = fFiles[fFile];
+    if (fFileAcc < f.nrun) return false;
+    for (std::size_t r=0; r<fN.size(); r++) if (fN[r] > 0 && fFileN[r] < f.nregion) return false;
+    return true;
+  }
+  void SetCluster(std::size_t k) {
+    fClus = k;
+    fCur = fClusters[k].first; fEnd = fClusters[k].second;
+    fRead.push_back(fClusters[k]);
+    fNclusRead++;
+  }
+  // clusters of the next file w/ entries, in bit-reversed order
+  bool NextFile() {
+    fClusters.clear();
+    while (fClusters.empty()) {
+      if (++fFile >= Int_t(fFiles.size())) return false;
+      if (fFiles[fFile].nentries <= 0 || fChain->LoadTree(fOffset[fFile]) < 0 || !fChain->GetTree()) continue;
+      TTree *T = fChain->GetTree();
+      Long64_t n = fFiles[fFile].nentries, start;
+      std::vector<std::pair<Long64_t, Long64_t> > clusters;
+      TTree::TClusterIterator it = T->GetClusterIterator(0);
+      while ((start = it()) < n) clusters.push_back(std::make_pair(fOffset[fFile] + start, fOffset[fFile] + std::min(it.GetNextEntry(), n)));
+      UInt_t nbits = 0;
+      while ((std::size_t(1) << nbits) < clusters.size()) nbits++;
+      for (std::size_t i=0; i<(std::size_t(1) << nbits); i++) {
+	std::size_t rev = 0;
+	for (UInt_t b=0; b<nbits; b++) if (i & (std::size_t(1) << b)) rev |= std::size_t(1) << (nbits-1-b);
+	if (rev < clusters.size()) fClusters.push_back(clusters[rev]);
+      }
+      fNclus += clusters.size();
+    }
+    fFileRead = fFileAcc = 0;
+    std::fill(fFileN.begin(), fFileN.end(), 0);
+    SetCluster(0);
+    return true;
+  }
+};
+
+#endif
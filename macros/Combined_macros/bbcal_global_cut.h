@@ -0,0 +1,334 @@
+#ifndef BBCAL_GLOBAL_CUT_H
+#define BBCAL_GLOBAL_CUT_H
+/*
+  Global cut of the BBCAL calibration macros compiled once per job instead of being interpreted by
+  TTreeFormula for every event. The cut string (e.g. "bb.tr.n==1&&abs(bb.tr.vz[0])<0.27") is parsed
+  into a flat postfix program whose variables point directly into the branch buffers, so evaluating
+  it is a tight loop w/o any leaf lookups. Branches already bound by the macro are shared (a TChain
+  branch can only have one address), the others get their own buffer. The branches the cut needs
+  are known after parsing & only those are switched on.
+  Supported: numbers, Double_t branches w/ an optional constant index (w/o index: element 0, as
+  EvalInstance(0)), + - * / % ! && || == != < <= > >=, parentheses & abs, fabs, sqrt, exp, log,
+  log10, sin, cos, tan, pow, atan2, min, max (also as TMath::...); % truncates both operands to integers
+  first, as TTreeFormula (x % 0 gives 0). Anything else (other leaf types,
+  special TTreeFormula syntax) falls back to TTreeFormula w/ a warning. Unlike TTreeFormula both
+  sides of && and || are always evaluated, which doesn't change the result.
+  The own buffers are sized from the leaf counts of the current tree, so a new tree must be loaded &
+  the cut rebound before its first entry is read (LoadTree), not after GetEntry.
+  Usage:
+    BBGlobalCut *GlobalCut = new BBGlobalCut("GlobalCut", globalcut);
+    ... C->SetBranchAddress(...) for everything the macro reads ...
+    GlobalCut->Bind(C);                            // switches on & binds the branches of the cut
+    while (GlobalCut->LoadTree(nevent) && C->GetEntry(nevent++)) {   // rebinds on tree change
+      bool passedgCut = GlobalCut->EvalInstance(0) != 0;
+    }
+*/
+
+#include <map>
+#include <cmath>
+#include <cctype>
+#include <cstring>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+
+#include "TLeaf.h"
+#include "TChain.h"
+#include "TString.h"
+#include "TBranch.h"
+#include "TChainElement.h"
+#include "TTreeFormula.h"
+
+class BBGlobalCut {
+public:
+  BBGlobalCut(char const * name, char const * cut) : fName(name), fCut(cut), fCompiled(false), fResolved(false), fFormula(0), fChain(0), fTreeNum(-1) {
+    fCut.ReplaceAll(" ", ""); fCut.ReplaceAll("\t", "");
+    if (fCut.Length() == 0) { fCompiled = true; return; }
+    fPos = 0; fDepth = 0; fMaxDepth = 0; fError = "";
+    fCompiled = ParseOr() && fPos == fCut.Length() && fMaxDepth <= kMaxStack;
+    if (fCompiled) return;
+    if (fError == "") fError = fPos < fCut.Length() ? Form("unexpected \"%s\"", fCut(fPos, fCut.Length()-fPos).Data()) : "expression too deep";
+    fProg.clear(); fVars.clear(); fVarId.clear(); fBranches.clear();
+  }
+  ~BBGlobalCut() { delete fFormula; }
+
+  // switches on the branches of the cut & binds them. Call after the macro's own SetBranchAddress calls.
+  void Bind(TChain *C) {
+    fChain = C;
+    if (fCompiled) {
+      for (std::size_t i=0; i<fVars.size() && fCompiled; i++) {
+	TLeaf *leaf = C->GetLeaf(fVars[i].branch);
+	if (!leaf || !C->GetBranch(fVars[i].branch)) fError = Form("no branch %s", fVars[i].branch.Data());
+	else if (TString(leaf->GetTypeName()) != "Double_t") fError = Form("%s is %s", fVars[i].branch.Data(), leaf->GetTypeName());
+	if (fError != "") fCompiled = false;
+      }
+    }
+    if (!fCompiled) {
+      std::cout << "*!*[WARNING] Global cut could not be compiled (" << fError << "). Using TTreeFormula.\n";
+      fProg.clear(); fVars.clear(); fBranches.clear();
+      fFormula = new TTreeFormula(fName, fCut, C);
+      for (Int_t i=0; i<fFormula->GetNcodes(); i++) {
+	if (fFormula->GetLeaf(i)) AddBranch(fFormula->GetLeaf(i)->GetBranch()->GetName());
+      }
+    }
+    for (std::size_t i=0; i<fBranches.size(); i++) C->SetBranchStatus(fBranches[i], 1);
+    if (fCompiled) {
+      for (std::size_t i=0; i<fVars.size(); i++) {
+	TChainElement *el = (TChainElement*)C->GetStatus()->FindObject(fVars[i].branch);
+	if (el && el->GetBaddress()) fVars[i].ptr = (Double_t*)el->GetBaddress();  // macro's own buffer
+	else fVars[i].own = true;
+      }
+      UpdateFormulaLeaves();
+    }
+  }
+  // loads the tree of entry w/o reading it & rebinds the cut if it is a new one. False past the end of the chain.
+  bool LoadTree(Long64_t entry) {
+    if (entry < 0 || fChain->LoadTree(entry) < 0) return false;
+    if (fChain->GetTreeNumber() != fTreeNum) {
+      fTreeNum = fChain->GetTreeNumber();
+      UpdateFormulaLeaves();
+    }
+    return true;
+  }
+  // to be called whenever the chain moves to a new tree, before an entry of it is read [done by LoadTree]
+  void UpdateFormulaLeaves() {
+    if (fFormula) { fFormula->UpdateFormulaLeaves(); return; }
+    bool rebind = false;
+    for (std::size_t i=0; i<fVars.size(); i++) {
+      Var & v = fVars[i];
+      if (!v.own) continue;
+      // own buffers have room for the largest array seen so far
+      TLeaf *leaf = fChain->GetLeaf(v.branch);
+      Int_t len = leaf ? leaf->GetLenStatic() * (leaf->GetLeafCount() ? leaf->GetLeafCount()->GetMaximum() : 1) : 1;
+      len = std::max(std::max(len, v.maxindex+1), 1);
+      if (Int_t(v.buf.size()) < len || !v.ptr) {
+	v.buf.assign(std::max(len, 2*Int_t(v.buf.size())), 0.);
+	v.ptr = &v.buf[0];
+	fChain->SetBranchAddress(v.branch, v.ptr);
+	rebind = true;
+      }
+    }
+    if (rebind || fProg.empty() || !fResolved) Resolve();
+  }
+  // to be called when the macro has moved the buffer of a branch shared w/ the cut (SetBranchAddress)
+  void UpdateSharedBuffers() {
+    if (!fCompiled || !fChain) return;
+    for (std::size_t i=0; i<fVars.size(); i++) {
+      if (fVars[i].own) continue;
+      TChainElement *el = (TChainElement*)fChain->GetStatus()->FindObject(fVars[i].branch);
+      if (el && el->GetBaddress()) fVars[i].ptr = (Double_t*)el->GetBaddress();
+    }
+    Resolve();
+  }
+  Double_t EvalInstance(Int_t = 0) {
+    if (fFormula) return fFormula->EvalInstance(0);
+    if (fProg.empty()) return 1.;
+    Double_t st[kMaxStack];
+    Int_t sp = -1;
+    for (std::size_t k=0; k<fProg.size(); k++) {
+      Op const & op = fProg[k];
+      switch (op.code) {
+      case kConst: st[++sp] = op.val; break;
+      case kVar:   st[++sp] = *op.ptr; break;
+      case kNeg:   st[sp] = -st[sp]; break;
+      case kNot:   st[sp] = !(st[sp] != 0); break;
+      case kAbs:   st[sp] = fabs(st[sp]); break;
+      case kSqrt:  st[sp] = sqrt(st[sp]); break;
+      case kExp:   st[sp] = exp(st[sp]); break;
+      case kLog:   st[sp] = log(st[sp]); break;
+      case kLog10: st[sp] = log10(st[sp]); break;
+      case kSin:   st[sp] = sin(st[sp]); break;
+      case kCos:   st[sp] = cos(st[sp]); break;
+      case kTan:   st[sp] = tan(st[sp]); break;
+      default: {
+	Double_t b = st[sp--], & a = st[sp];
+	switch (op.code) {
+	case kAdd:   a = a + b; break;
+	case kSub:   a = a - b; break;
+	case kMul:   a = a * b; break;
+	case kDiv:   a = a / b; break;
+	case kMod:   a = Long64_t(b) != 0 ? Double_t(Long64_t(a) % Long64_t(b)) : 0.; break;   // as TTreeFormula
+	case kEq:    a = a == b; break;
+	case kNe:    a = a != b; break;
+	case kLt:    a = a < b; break;
+	case kLe:    a = a <= b; break;
+	case kGt:    a = a > b; break;
+	case kGe:    a = a >= b; break;
+	case kAnd:   a = (a != 0) && (b != 0); break;
+	case kOr:    a = (a != 0) || (b != 0); break;
+	case kPow:   a = pow(a, b); break;
+	case kAtan2: a = atan2(a, b); break;
+	case kMin:   a = std::min(a, b); break;
+	case kMax:   a = std::max(a, b); break;
+	default: break;
+	}
+      }
+      }
+    }
+    return st[0];
+  }
+
+  bool IsCompiled() const { return fCompiled; }
+  TString const & GetCut() const { return fCut; }
+  std::vector<TString> const & GetBranches() const { return fBranches; }   // known after parsing (or Bind w/ TTreeFormula)
+
+private:
+  enum { kMaxStack = 64 };
+  enum Code { kConst, kVar, kNeg, kNot, kAbs, kSqrt, kExp, kLog, kLog10, kSin, kCos, kTan,
+	      kAdd, kSub, kMul, kDiv, kMod, kEq, kNe, kLt, kLe, kGt, kGe, kAnd, kOr, kPow, kAtan2, kMin, kMax };
+  struct Op {
+    Code code; Double_t val; Int_t var, index; Double_t const * ptr;
+    Op(Code c, Double_t v = 0., Int_t iv = -1, Int_t idx = 0) : code(c), val(v), var(iv), index(idx), ptr(0) {}
+  };
+  struct Var {
+    TString branch; Int_t maxindex; bool own; Double_t *ptr; std::vector<Double_t> buf;
+    Var(TString const & b) : branch(b), maxindex(0), own(false), ptr(0) {}
+  };
+
+  TString fName, fCut, fError;
+  bool fCompiled, fResolved;
+  std::vector<Op> fProg;
+  std::vector<Var> fVars;
+  std::map<TString, Int_t> fVarId;
+  std::vector<TString> fBranches;
+  TTreeFormula *fFormula;           // fallback
+  TChain *fChain;
+  Int_t fTreeNum;                   // tree the buffers are sized for
+  Int_t fPos, fDepth, fMaxDepth;
+
+  void Resolve() {
+    for (std::size_t k=0; k<fProg.size(); k++)
+      if (fProg[k].code == kVar) fProg[k].ptr = fVars[fProg[k].var].ptr + fProg[k].index;
+    fResolved = true;
+  }
+  void AddBranch(TString const & b) {
+    for (std::size_t i=0; i<fBranches.size(); i++) if (fBranches[i] == b) return;
+    fBranches.push_back(b);
+  }
+  // emits an op & keeps track of the stack depth
+  void Emit(Op const & op) {
+    fProg.push_back(op);
+    if (op.code == kConst || op.code == kVar) { if (++fDepth > fMaxDepth) fMaxDepth = fDepth; }
+    else if (op.code >= kAdd) fDepth--;
+  }
+
+  // recursive descent, lowest precedence first
+  char Peek(Int_t k = 0) const { return fPos+k < fCut.Length() ? fCut[fPos+k] : '\0'; }
+  bool Accept(char const * tok) {
+    Int_t n = strlen(tok);
+    if (fCut.Length() - fPos < n || TString(fCut(fPos, n)) != tok) return false;
+    fPos += n;
+    return true;
+  }
+  bool ParseOr() {
+    if (!ParseAnd()) return false;
+    while (Accept("||")) { if (!ParseAnd()) return false; Emit(Op(kOr)); }
+    return true;
+  }
+  bool ParseAnd() {
+    if (!ParseCmp()) return false;
+    while (Accept("&&")) { if (!ParseCmp()) return false; Emit(Op(kAnd)); }
+    return true;
+  }
+  bool ParseCmp() {
+    if (!ParseAdd()) return false;
+    while (true) {
+      Code c;
+      if (Accept("==")) c = kEq; else if (Accept("!=")) c = kNe;
+      else if (Accept("<=")) c = kLe; else if (Accept(">=")) c = kGe;
+      else if (Accept("<")) c = kLt; else if (Accept(">")) c = kGt;
+      else return true;
+      if (!ParseAdd()) return false;
+      Emit(Op(c));
+    }
+  }
+  bool ParseAdd() {
+    if (!ParseMul()) return false;
+    while (true) {
+      Code c;
+      if (Accept("+")) c = kAdd; else if (Accept("-")) c = kSub; else return true;
+      if (!ParseMul()) return false;
+      Emit(Op(c));
+    }
+  }
+  bool ParseMul() {
+    if (!ParseUnary()) return false;
+    while (true) {
+      Code c;
+      if (Accept("*")) c = kMul; else if (Accept("/")) c = kDiv; else if (Accept("%")) c = kMod; else return true;
+      if (!ParseUnary()) return false;
+      Emit(Op(c));
+    }
+  }
+  bool ParseUnary() {
+    if (Peek() == '!' && Peek(1) != '=') { fPos++; if (!ParseUnary()) return false; Emit(Op(kNot)); return true; }
+    if (Accept("-")) { if (!ParseUnary()) return false; Emit(Op(kNeg)); return true; }
+    if (Accept("+")) return ParseUnary();
+    return ParsePrimary();
+  }
+  bool ParsePrimary() {
+    if (Accept("(")) {
+      if (!ParseOr()) return false;
+      if (!Accept(")")) { fError = "missing )"; return false; }
+      return true;
+    }
+    char c = Peek();
+    if (isdigit(c) || (c == '.' && isdigit(Peek(1)))) {
+      char const * start = fCut.Data() + fPos;
+      char *end = 0;
+      Double_t v = strtod(start, &end);
+      fPos += end - start;
+      Emit(Op(kConst, v));
+      return true;
+    }
+    if (!isalpha(c) && c != '_') return false;
+    Int_t start = fPos;
+    while (isalnum(Peek()) || Peek() == '_' || Peek() == '.' || (Peek() == ':' && Peek(1) == ':')) fPos += Peek() == ':' ? 2 : 1;
+    TString ident = fCut(start, fPos-start);
+    if (Peek() == '(') return ParseFunction(ident);
+    Int_t index = 0;
+    if (Accept("[")) {
+      Int_t istart = fPos;
+      while (isdigit(Peek())) fPos++;
+      if (fPos == istart || !Accept("]")) { fError = Form("non-constant index of %s", ident.Data()); return false; }
+      index = TString(fCut(istart, fPos-istart-1)).Atoi();
+    }
+    if (Peek() == '[') { fError = Form("multiple indices of %s", ident.Data()); return false; }
+    std::map<TString, Int_t>::iterator it = fVarId.find(ident);
+    Int_t id;
+    if (it == fVarId.end()) { id = fVars.size(); fVarId[ident] = id; fVars.push_back(Var(ident)); AddBranch(ident); }
+    else id = it->second;
+    fVars[id].maxindex = std::max(fVars[id].maxindex, index);
+    Emit(Op(kVar, 0., id, index));
+    return true;
+  }
+  bool ParseFunction(TString fname) {
+    if (fname.BeginsWith("TMath::")) fname.Remove(0, 7);
+    fname.ToLower();
+    Code c; Int_t nargs = 1;
+    if (fname == "abs" || fname == "fabs") c = kAbs;
+    else if (fname == "sqrt") c = kSqrt;
+    else if (fname == "exp") c = kExp;
+    else if (fname == "log") c = kLog;
+    else if (fname == "log10") c = kLog10;
+    else if (fname == "sin") c = kSin;
+    else if (fname == "cos") c = kCos;
+    else if (fname == "tan") c = kTan;
+    else if (fname == "pow" || fname == "power") { c = kPow; nargs = 2; }
+    else if (fname == "atan2") { c = kAtan2; nargs = 2; }
+    else if (fname == "min") { c = kMin; nargs = 2; }
+    else if (fname == "max") { c = kMax; nargs = 2; }
+    else { fError = Form("unknown function %s", fname.Data()); return false; }
+    Accept("(");
+    for (Int_t i=0; i<nargs; i++) {
+      if (i > 0 && !Accept(",")) { fError = Form("%s needs %d arguments", fname.Data(), nargs); return false; }
+      if (!ParseOr()) return false;
+    }
+    if (!Accept(")")) { fError = "missing )"; return false; }
+    Emit(Op(c));
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef BBCAL_KINEMATICS_H
+#define BBCAL_KINEMATICS_H
+/*
+  Elastic e-p kinematics of the BigBite electron for a batch of events, w/o TVector3/TLorentzVector
+  temporaries. Inputs & outputs are kept as structure of arrays (one array per quantity, allocated
+  once) and every stage is a plain loop over the batch, so the compiler can vectorize it. The
+  constant frames (HCAL & GEM axes) are set up once. The arithmetic follows the former per-event
+  TVector3/TLorentzVector code operation by operation, so the results are the same.
+  Usage:
+    BBKineConfig kcfg(E_beam, Mp);
+    kcfg.SetHCAL(HCAL_origin, HCAL_xaxis, HCAL_yaxis, HCAL_zaxis);
+    kcfg.SetMomCalib(A_fit, B_fit, C_fit, Avy_fit, Bvy_fit, bb_magdist, GEMpitch);   // optional
+    BBKineBatch kine(nmax);
+    kine.p[i] = trP[0]; kine.px[i] = ...;       // i < n
+    BBKineCompute(kcfg, kine, n);
+    ... kine.W2[i], kine.hcalX_exp[i], ...
+*/
+
+#include <cmath>
+#include <vector>
+
+#include "TMath.h"
+#include "TVector3.h"
+
+struct BBKineConfig {
+  Double_t Ebeam, Mp;
+  Double_t pOffset;                      // momentum fudge factor (p_rec_Offset)
+  bool     elasticNucleon;               // recoil direction from the elastic constraint (coplanar) instead of q
+  bool     hcal;                         // compute the expected HCAL position?
+  Double_t hcalO[3], hcalX[3], hcalY[3], hcalZ[3];
+  bool     momCalib;                     // momentum from the track bend angle
+  Double_t A, B, C, Avy, Bvy, magdist;
+  Double_t gemX[3], gemY[3], gemZ[3];
+
+  BBKineConfig(Double_t ebeam, Double_t mp, Double_t poffset = 1.)
+    : Ebeam(ebeam), Mp(mp), pOffset(poffset), elasticNucleon(false), hcal(false),
+      momCalib(false), A(0.), B(0.), C(0.), Avy(0.), Bvy(0.), magdist(0.)
+  {
+    for (Int_t k=0; k<3; k++) hcalO[k] = hcalX[k] = hcalY[k] = hcalZ[k] = gemX[k] = gemY[k] = gemZ[k] = 0.;
+  }
+
+  void SetHCAL(TVector3 const & origin, TVector3 const & xaxis, TVector3 const & yaxis, TVector3 const & zaxis) {
+    hcal = true;
+    for (Int_t k=0; k<3; k++) { hcalO[k] = origin[k]; hcalX[k] = xaxis[k]; hcalY[k] = yaxis[k]; hcalZ[k] = zaxis[k]; }
+  }
+  // GEM frame w/ the given pitch (deg), as used for the bend angle
+  void SetMomCalib(Double_t a, Double_t b, Double_t c, Double_t avy, Double_t bvy, Double_t bbmagdist, Double_t GEMpitch) {
+    momCalib = true;
+    A = a; B = b; C = c; Avy = avy; Bvy = bvy; magdist = bbmagdist;
+    TVector3 GEMzaxis(-sin(GEMpitch*TMath::DegToRad()),0,cos(GEMpitch*TMath::DegToRad()));
+    TVector3 GEMyaxis(0,1,0);
+    TVector3 GEMxaxis = (GEMyaxis.Cross(GEMzaxis)).Unit();
+    for (Int_t k=0; k<3; k++) { gemX[k] = GEMxaxis[k]; gemY[k] = GEMyaxis[k]; gemZ[k] = GEMzaxis[k]; }
+  }
+};
+
+struct BBKineBatch {
+  Int_t nmax;
+  // input: best track (tg_* & r_* & vy are needed w/ momCalib only, vz w/ HCAL only)
+  std::vector<Double_t> p, px, py, pz, vz, vy, tgth, tgph, rth, rph;
+  // output
+  std::vector<Double_t> thetabend;                 // momCalib only
+  std::vector<Double_t> p_rec, px_rec, py_rec, pz_rec;
+  std::vector<Double_t> etheta, ephi, pelas, PovPel, nu, Q2, W2;
+  std::vector<Double_t> pNx, pNy, pNz;             // unit vector along the recoil nucleon
+  std::vector<Double_t> pN, thetaN, phiN;          // expected nucleon momentum & angles, elasticNucleon only
+  std::vector<Double_t> hcalX_exp, hcalY_exp;      // HCAL only
+
+  BBKineBatch(Int_t n = 1) : nmax(n) {
+    std::vector<Double_t> * arrs[] = {&p, &px, &py, &pz, &vz, &vy, &tgth, &tgph, &rth, &rph, &thetabend, &p_rec, &px_rec,
+				      &py_rec, &pz_rec, &etheta, &ephi, &pelas, &PovPel, &nu, &Q2, &W2, &pNx, &pNy, &pNz,
+				      &pN, &thetaN, &phiN, &hcalX_exp, &hcalY_exp};
+    for (std::size_t i=0; i<sizeof(arrs)/sizeof(arrs[0]); i++) arrs[i]->assign(n, 0.);
+  }
+};
+
+// unit vector, as TVector3::Unit()
+inline void BBKineUnit(Double_t & x, Double_t & y, Double_t & z) {
+  Double_t tot2 = x*x + y*y + z*z;
+  Double_t tot = (tot2 > 0) ? 1.0/TMath::Sqrt(tot2) : 1.0;
+  x *= tot; y *= tot; z *= tot;
+}
+
+// computes the first n (<= nmax) events of the batch
+inline void BBKineCompute(BBKineConfig const & cfg, BBKineBatch & b, Int_t n) {
+  Double_t const E = cfg.Ebeam, Mp = cfg.Mp;
+  Double_t const * p = &b.p[0], * px = &b.px[0], * py = &b.py[0], * pz = &b.pz[0];
+
+  // momentum: track momentum or the one from the bend angle, times the fudge factor
+  Double_t * offset = &b.p_rec[0];  // used for the calibration offset first
+  if (cfg.momCalib) {
+    Double_t const * tgth = &b.tgth[0], * tgph = &b.tgph[0], * rth = &b.rth[0], * rph = &b.rph[0], * vy = &b.vy[0];
+    Double_t * thetabend = &b.thetabend[0];
+    for (Int_t i=0; i<n; i++) {
+      Double_t tx = tgth[i], ty = tgph[i], tz = 1.0;
+      BBKineUnit(tx, ty, tz);
+      Double_t fx = rth[i], fy = rph[i], fz = 1.0;
+      BBKineUnit(fx, fy, fz);
+      Double_t rx = fx*cfg.gemX[0] + fy*cfg.gemY[0] + fz*cfg.gemZ[0];
+      Double_t ry = fx*cfg.gemX[1] + fy*cfg.gemY[1] + fz*cfg.gemZ[1];
+      Double_t rz = fx*cfg.gemX[2] + fy*cfg.gemY[2] + fz*cfg.gemZ[2];
+      thetabend[i] = acos(rx*tx + ry*ty + rz*tz);
+      Double_t p_calib = cfg.A * (1. + (cfg.B + cfg.C*cfg.magdist) * tgth[i]) / thetabend[i];
+      p_calib -= (cfg.Avy + cfg.Bvy * vy[i]);
+      offset[i] = p_calib / p[i];
+    }
+  } else {
+    for (Int_t i=0; i<n; i++) offset[i] = p[i] / p[i];
+  }
+  Double_t * p_rec = &b.p_rec[0], * px_rec = &b.px_rec[0], * py_rec = &b.py_rec[0], * pz_rec = &b.pz_rec[0];
+  for (Int_t i=0; i<n; i++) {
+    Double_t off = offset[i];
+    px_rec[i] = px[i] * off * cfg.pOffset;
+    py_rec[i] = py[i] * off * cfg.pOffset;
+    pz_rec[i] = pz[i] * off * cfg.pOffset;
+    p_rec[i] = p[i] * off * cfg.pOffset;
+  }
+
+  // electron & q = Pe - Pe', recoil = q + Pp
+  Double_t * etheta = &b.etheta[0], * ephi = &b.ephi[0], * pelas = &b.pelas[0], * PovPel = &b.PovPel[0];
+  Double_t * nu = &b.nu[0], * Q2 = &b.Q2[0], * W2 = &b.W2[0];
+  Double_t * pNx = &b.pNx[0], * pNy = &b.pNy[0], * pNz = &b.pNz[0];
+  for (Int_t i=0; i<n; i++) {
+    etheta[i] = TMath::ACos(pz_rec[i] / p_rec[i]);
+    ephi[i] = atan2(py_rec[i], px_rec[i]);
+    pelas[i] = E/(1. + (E/Mp)*(1.0-cos(etheta[i])));
+    PovPel[i] = p_rec[i]/pelas[i];
+    Double_t qx = 0 - px_rec[i], qy = 0 - py_rec[i], qz = E - pz_rec[i], qE = E - p_rec[i];
+    Double_t q3sq = qx*qx + qy*qy + qz*qz;
+    nu[i] = qE;
+    Q2[i] = -(qE*qE - q3sq);
+    W2[i] = (qE + Mp)*(qE + Mp) - q3sq;
+    pNx[i] = qx; pNy[i] = qy; pNz[i] = qz;
+  }
+  if (cfg.elasticNucleon) {
+    // elastic constraint on the nucleon angle, coplanar w/ the electron
+    Double_t * pN = &b.pN[0], * thetaN = &b.thetaN[0], * phiN = &b.phiN[0];
+    for (Int_t i=0; i<n; i++) {
+      pN[i] = sqrt(pow(nu[i],2)+2.*Mp*nu[i]);
+      thetaN[i] = acos((E - p_rec[i]*cos(etheta[i]))/pN[i]);
+      phiN[i] = ephi[i] + TMath::Pi();
+      pNx[i] = sin(thetaN[i])*cos(phiN[i]); pNy[i] = sin(thetaN[i])*sin(phiN[i]); pNz[i] = cos(thetaN[i]);
+    }
+  } else {
+    for (Int_t i=0; i<n; i++) BBKineUnit(pNx[i], pNy[i], pNz[i]);
+  }
+
+  // straight line from the vertex to the HCAL plane
+  if (cfg.hcal) {
+    Double_t const * vz = &b.vz[0];
+    Double_t const * O = cfg.hcalO, * X = cfg.hcalX, * Y = cfg.hcalY, * Z = cfg.hcalZ;
+    Double_t * hcalX_exp = &b.hcalX_exp[0], * hcalY_exp = &b.hcalY_exp[0];
+    for (Int_t i=0; i<n; i++) {
+      Double_t ox = O[0] - 0, oy = O[1] - 0, oz = O[2] - vz[i];
+      Double_t s = (ox*Z[0] + oy*Z[1] + oz*Z[2]) / (pNx[i]*Z[0] + pNy[i]*Z[1] + pNz[i]*Z[2]);
+      Double_t dx = (0 + s*pNx[i]) - O[0], dy = (0 + s*pNy[i]) - O[1], dz = (vz[i] + s*pNz[i]) - O[2];
+      hcalX_exp[i] = dx*X[0] + dy*X[1] + dz*X[2];
+      hcalY_exp[i] = dx*Y[0] + dy*Y[1] + dz*Y[2];
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef BBCAL_RUN_HIST_H
+#define BBCAL_RUN_HIST_H
+/*
+  Run-indexed replacement for the "X vs run #" TH2's & TProfile's, which used to be booked w/ a fixed
+  run axis (Nruns = 1000 bins) although a job sees a few tens to hundreds of runs. An accumulator is
+  allocated per run index (1, 2, ... in the order the runs are met) at its 1st fill. It holds the y
+  distribution (binning of the TH2 y axis, incl. under- & overflow) & the moments of y, plus those of
+  the entries inside the profile y range (like TProfile::Fill). Merging per-thread or per-job copies
+  just adds the accumulators of the runs they saw; GetState()/AddState() carry them through a file
+  (process-level shards, see calib_shard.h). The TH2 & TProfile w/ one bin per run are made
+  once at the end; labelling them w/ the run numbers is left to the macro (Custm2DRnumHisto).
+  Usage:
+    BBRunHist rh("h2_EovP_vs_rnum", "E/p vs Run no", 200, 0.4, 1.6);
+    rh.SetProfile("h2_EovP_vs_rnum_prof", "E/p vs Run no. (Profile)", 0.4, 1.6, "S");   // optional
+    ...
+    rh.Fill(itrrun, EovP);                           // per event
+    ...
+    TH2F *h2 = rh.MakeTH2<TH2F>(lrnum.size());       // in the current directory
+    TProfile *hp = rh.MakeProfile(lrnum.size());
+    Custm2DRnumHisto(h2, lrnum);
+*/
+
+#include <map>
+#include <cmath>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+#include "TH2.h"
+#include "TString.h"
+#include "TMatrixD.h"
+#include "TProfile.h"
+
+class BBRunHist {
+public:
+  BBRunHist(char const * name, char const * title, Int_t nbinsy, Double_t ymin, Double_t ymax)
+    : fName(name), fTitle(title), fNbinsy(nbinsy), fYmin(ymin), fYmax(ymax),
+      fProf(false), fPylow(0.), fPyup(0.), fLast(0), fLastRun(0) {}
+  BBRunHist(BBRunHist const & o) { *this = o; }
+  BBRunHist & operator=(BBRunHist const & o) {
+    fName = o.fName; fTitle = o.fTitle; fNbinsy = o.fNbinsy; fYmin = o.fYmin; fYmax = o.fYmax;
+    fProf = o.fProf; fPname = o.fPname; fPtitle = o.fPtitle; fPylow = o.fPylow; fPyup = o.fPyup; fPopt = o.fPopt;
+    fRuns = o.fRuns;
+    fLast = 0; fLastRun = 0;   // points into fRuns
+    return *this;
+  }
+
+  // also keep a profile (TProfile w/ the given y range, the full range if ylow == yup, & error option)
+  void SetProfile(char const * name, char const * title, Double_t ylow = 0., Double_t yup = 0., char const * option = "") {
+    fProf = true; fPname = name; fPtitle = title; fPylow = ylow; fPyup = yup; fPopt = option;
+  }
+  TString const & GetName() const { return fName; }
+
+  void Fill(Int_t irun, Double_t y, Double_t w = 1.) {
+    RunAcc & a = Get(irun);
+    Int_t bin = !(y >= fYmin) ? 0 : (y >= fYmax ? fNbinsy+1 : 1 + Int_t(fNbinsy*(y - fYmin)/(fYmax - fYmin)));
+    if (w != 1. && a.sumw2.empty()) a.sumw2 = a.sumw;   // unit weights so far
+    a.sumw[bin] += w;
+    if (!a.sumw2.empty()) a.sumw2[bin] += w*w;
+    a.n++; a.sw += w; a.swy += w*y; a.swy2 += w*y*y;
+    if (fProf && (fPylow == fPyup || (y >= fPylow && y <= fPyup))) {
+      a.pn++; a.psw += w; a.psw2 += w*w; a.pswy += w*y; a.pswy2 += w*y*y;
+    }
+  }
+
+  // adds the runs of another copy (e.g. of another thread)
+  void Add(BBRunHist const & o) {
+    if (o.fNbinsy != fNbinsy || o.fYmin != fYmin || o.fYmax != fYmax) {
+      std::cerr << "*!*[ERROR] BBRunHist::Add: different binning of " << fName << " & " << o.fName << "\n";
+      std::exit(1);
+    }
+    for (std::map<Int_t, RunAcc>::const_iterator it = o.fRuns.begin(); it != o.fRuns.end(); ++it) {
+      RunAcc & a = Get(it->first);
+      RunAcc const & b = it->second;
+      if (!b.sumw2.empty() && a.sumw2.empty()) a.sumw2 = a.sumw;
+      for (Int_t i=0; i<fNbinsy+2; i++) {
+	a.sumw[i] += b.sumw[i];
+	if (!a.sumw2.empty()) a.sumw2[i] += b.sumw2.empty() ? b.sumw[i] : b.sumw2[i];
+      }
+      a.n += b.n; a.sw += b.sw; a.swy += b.swy; a.swy2 += b.swy2;
+      a.pn += b.pn; a.psw += b.psw; a.psw2 += b.psw2; a.pswy += b.pswy; a.pswy2 += b.pswy2;
+    }
+  }
+
+  // all accumulators as a matrix: row 0 = (nbinsy, ymin, ymax, # runs), then one row per run =
+  // (run index, n, sw, swy, swy2, pn, psw, psw2, pswy, pswy2, has sumw2, sumw[nbinsy+2], sumw2[nbinsy+2])
+  TMatrixD GetState() const {
+    TMatrixD s(1 + fRuns.size(), kNstate + 2*(fNbinsy+2));
+    s(0, 0) = fNbinsy; s(0, 1) = fYmin; s(0, 2) = fYmax; s(0, 3) = fRuns.size();
+    Int_t row = 1;
+    for (std::map<Int_t, RunAcc>::const_iterator it = fRuns.begin(); it != fRuns.end(); ++it, row++) {
+      RunAcc const & a = it->second;
+      Double_t v[kNstate] = {Double_t(it->first), Double_t(a.n), a.sw, a.swy, a.swy2, Double_t(a.pn), a.psw, a.psw2, a.pswy,
+			     a.pswy2, a.sumw2.empty() ? 0. : 1.};
+      for (Int_t k=0; k<kNstate; k++) s(row, k) = v[k];
+      for (Int_t i=0; i<fNbinsy+2; i++) {
+	s(row, kNstate + i) = a.sumw[i];
+	if (!a.sumw2.empty()) s(row, kNstate + fNbinsy+2 + i) = a.sumw2[i];
+      }
+    }
+    return s;
+  }
+  // adds the accumulators of a GetState() matrix
+  void AddState(TMatrixD const & s) {
+    BBRunHist o(*this);
+    o.fRuns.clear();
+    if (Int_t(s(0, 0)) != fNbinsy || s(0, 1) != fYmin || s(0, 2) != fYmax || s.GetNcols() != kNstate + 2*(fNbinsy+2)) {
+      std::cerr << "*!*[ERROR] BBRunHist::AddState: different binning of " << fName << "\n";
+      std::exit(1);
+    }
+    for (Int_t row=1; row<s.GetNrows(); row++) {
+      RunAcc & a = o.fRuns[Int_t(s(row, 0))];
+      a.n = Long64_t(s(row, 1)); a.sw = s(row, 2); a.swy = s(row, 3); a.swy2 = s(row, 4);
+      a.pn = Long64_t(s(row, 5)); a.psw = s(row, 6); a.psw2 = s(row, 7); a.pswy = s(row, 8); a.pswy2 = s(row, 9);
+      a.sumw.resize(fNbinsy+2);
+      for (Int_t i=0; i<fNbinsy+2; i++) a.sumw[i] = s(row, kNstate + i);
+      if (s(row, 10) != 0.) {
+	a.sumw2.resize(fNbinsy+2);
+	for (Int_t i=0; i<fNbinsy+2; i++) a.sumw2[i] = s(row, kNstate + fNbinsy+2 + i);
+      }
+    }
+    Add(o);
+  }
+
+  // highest run index filled (0 if none)
+  Int_t GetNruns() const { return fRuns.empty() ? 0 : fRuns.rbegin()->first; }
+  Long64_t GetEntries(Int_t irun) const { RunAcc const * a = Find(irun); return a ? a->n : 0; }
+  Double_t GetMean(Int_t irun) const { RunAcc const * a = Find(irun); return a && a->sw ? a->swy/a->sw : 0.; }
+  Double_t GetStdDev(Int_t irun) const {
+    RunAcc const * a = Find(irun);
+    if (!a || !a->sw) return 0.;
+    Double_t m = a->swy/a->sw;
+    return std::sqrt(std::max(0., a->swy2/a->sw - m*m));
+  }
+
+  // TH2 w/ one x bin per run index (at least nruns), in the current directory
+  template<class H> H * MakeTH2(Int_t nruns) const {
+    nruns = std::max(nruns, GetNruns());
+    H *h = new H(fName, fTitle, nruns, 0.5, nruns+0.5, fNbinsy, fYmin, fYmax);
+    bool weighted = false;
+    for (std::map<Int_t, RunAcc>::const_iterator it = fRuns.begin(); it != fRuns.end(); ++it)
+      if (!it->second.sumw2.empty()) weighted = true;
+    if (weighted) h->Sumw2();
+    Double_t nent = 0.;
+    for (std::map<Int_t, RunAcc>::const_iterator it = fRuns.begin(); it != fRuns.end(); ++it) {
+      RunAcc const & a = it->second;
+      Int_t ix = std::max(0, it->first);
+      for (Int_t iy=0; iy<fNbinsy+2; iy++) {
+	if (a.sumw[iy] == 0.) continue;
+	h->SetBinContent(ix, iy, a.sumw[iy]);
+	if (weighted) h->SetBinError(ix, iy, std::sqrt(a.sumw2.empty() ? a.sumw[iy] : a.sumw2[iy]));
+      }
+      nent += a.n;
+    }
+    h->ResetStats();
+    h->SetEntries(nent);
+    return h;
+  }
+  // TProfile w/ one bin per run index (0 if no profile was asked for), in the current directory
+  TProfile * MakeProfile(Int_t nruns) const {
+    if (!fProf) return 0;
+    nruns = std::max(nruns, GetNruns());
+    TProfile *p = new TProfile(fPname, fPtitle, nruns, 0.5, nruns+0.5, fPylow, fPyup, fPopt);
+    bool weighted = false;
+    for (std::map<Int_t, RunAcc>::const_iterator it = fRuns.begin(); it != fRuns.end(); ++it)
+      if (!it->second.sumw2.empty()) weighted = true;
+    if (weighted) p->Sumw2();
+    Double_t nent = 0.;
+    for (std::map<Int_t, RunAcc>::const_iterator it = fRuns.begin(); it != fRuns.end(); ++it) {
+      RunAcc const & a = it->second;
+      Int_t ix = std::max(0, it->first);
+      // TProfile bins: sum w*y (content), sum w*y^2 (Sumw2), sum w (entries) & sum w^2
+      p->SetBinContent(ix, a.pswy);
+      (*p->GetSumw2())[ix] = a.pswy2;
+      p->SetBinEntries(ix, a.psw);
+      if (p->GetBinSumw2()->GetSize()) (*p->GetBinSumw2())[ix] = a.psw2;
+      nent += a.pn;
+    }
+    p->ResetStats();
+    p->SetEntries(nent);
+    return p;
+  }
+
+private:
+  enum { kNstate = 11 };   // leading columns of a GetState() row
+  struct RunAcc {
+    std::vector<Double_t> sumw, sumw2;          // y distribution (sumw2 only after a non-unit weight)
+    Long64_t n;  Double_t sw, swy, swy2;        // all entries
+    Long64_t pn; Double_t psw, psw2, pswy, pswy2; // entries in the profile range
+    RunAcc() : n(0), sw(0.), swy(0.), swy2(0.), pn(0), psw(0.), psw2(0.), pswy(0.), pswy2(0.) {}
+  };
+
+  TString fName, fTitle;
+  Int_t fNbinsy;
+  Double_t fYmin, fYmax;
+  bool fProf;
+  TString fPname, fPtitle, fPopt;
+  Double_t fPylow, fPyup;
+  std::map<Int_t, RunAcc> fRuns;   // run index -> accumulator
+  RunAcc *fLast;                   // accumulator of the last run filled (runs change rarely)
+  Int_t fLastRun;
+
+  RunAcc & Get(Int_t irun) {
+    if (fLast && irun == fLastRun) return *fLast;
+    RunAcc & a = fRuns[irun];
+    if (a.sumw.empty()) a.sumw.assign(fNbinsy+2, 0.);
+    fLast = &a; fLastRun = irun;
+    return a;
+  }
+  RunAcc const * Find(Int_t irun) const {
+    std::map<Int_t, RunAcc>::const_iterator it = fRuns.find(irun);
+    return it == fRuns.end() ? 0 : &it->second;
+  }
+};
+
+#endif
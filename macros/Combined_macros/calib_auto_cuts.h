@@ -0,0 +1,236 @@
+#ifndef CALIB_AUTO_CUTS_H
+#define CALIB_AUTO_CUTS_H
+/*
+  Elastic cut parameters of the BBCAL energy calibration from a short pre-pass, instead of values read off
+  the plots of a previous full pass. The pre-pass reads a sample of the replayed files [see bbcal_event_sampler.h]
+  & keeps the track, the HCAL position & the cluster energy of every event passing the global cut (& the psE,
+  clusE cuts). The peaks are then fitted from histograms filled from that list (Gaussian around the maximum,
+  refitted twice in mean +/- width*sigma), each one w/ the other cuts applied so it sees clean elastics:
+    1. W of all the events
+    2. dx & dy of the events in the W window (mean +/- 2 sigma)
+    3. p_rec_Offset (optional): the PovPel peak of the events in the W window & the proton spot is moved to 1,
+       the kinematics are computed again w/ it & 1-2 repeated
+    4. PovPel & W of the events in the proton spot, E/p of the events in both windows;
+       EovP_cut limit = |E/p peak - 1| + nsigma*sigma
+  The values are rounded to 6 digits (so a shard & the merge job use the very same ones) & written in the
+  syntax of the configfile. The on/off flags & the nsigma of the cuts stay those of the configfile.
+  Usage:
+    CalibAutoCuts ac;
+    ac.Add(kine, hcalX, hcalY, clusE);      // per pre-pass event, kine: BBKineBatch w/ the track as input
+    ac.SetHists(hW, hPovPel, hdx, hdy, hEovP);
+    ac.Estimate(kcfg, fitOffset, 3., pmin, pmax);
+    ac.Print(std::cout); ac.Write(fname, ac.GetCfgLines(...));   // ac.Read(fname) gets them back
+    cuthash = GetCutHash(configfilename, ac.GetHashString());
+*/
+
+#include <cmath>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "TF1.h"
+#include "TH1D.h"
+#include "TString.h"
+#include "TObjArray.h"
+#include "TObjString.h"
+#include "bbcal_kinematics.h"
+
+// Gaussian fit of a peak: seeded w/ the maximum & its FWHM (not the RMS, the tails of W & E/p are wide),
+// then refitted twice in mean +/- width*sigma. False if too few entries or the fit ran away.
+inline bool FitAutoCutPeak(TH1D * h, Double_t width, Double_t & mean, Double_t & sigma) {
+  if (h->GetEntries() < 50) return false;
+  Int_t maxBin = h->GetMaximumBin();
+  Double_t half = 0.5*h->GetBinContent(maxBin);
+  Int_t lo = maxBin, hi = maxBin;
+  while (lo > 1 && h->GetBinContent(lo-1) > half) lo--;
+  while (hi < h->GetNbinsX() && h->GetBinContent(hi+1) > half) hi++;
+  mean = h->GetBinCenter(maxBin);
+  sigma = std::max(h->GetXaxis()->GetBinUpEdge(hi) - h->GetXaxis()->GetBinLowEdge(lo), h->GetBinWidth(maxBin))/2.355;
+  TF1 fitg(Form("fitg_%s", h->GetName()), "gaus", h->GetXaxis()->GetXmin(), h->GetXaxis()->GetXmax());
+  for (Int_t it=0; it<3; it++) {
+    fitg.SetRange(mean - width*sigma, mean + width*sigma);
+    fitg.SetParameters(h->GetBinContent(h->FindBin(mean)), mean, sigma);
+    h->Fit(&fitg, "NQR0");
+    mean = fitg.GetParameter(1); sigma = fabs(fitg.GetParameter(2));
+    if (!(sigma > 0.) || mean < h->GetXaxis()->GetXmin() || mean > h->GetXaxis()->GetXmax()) return false;
+  }
+  return true;
+}
+
+class CalibAutoCuts {
+public:
+  // results (ok*: estimated, otherwise the configfile values are kept)
+  bool okW, okPovPel, okPspot, okEovP, okOffset;
+  Double_t W_mean, W_sigma, PovPel_mean, PovPel_sigma;
+  Double_t dxM, dxS, dyM, dyS;
+  Double_t EovP_mean, EovP_sigma, EovP_cut_limit;
+  Double_t p_rec_Offset;
+  Long64_t Nread, N, Nw, Nspot, Nel;   // entries read & events: all, in the W window, in the spot, in both
+
+  CalibAutoCuts() : okW(false), okPovPel(false), okPspot(false), okEovP(false), okOffset(false),
+		    W_mean(0.), W_sigma(0.), PovPel_mean(0.), PovPel_sigma(0.), dxM(0.), dxS(0.), dyM(0.), dyS(0.),
+		    EovP_mean(0.), EovP_sigma(0.), EovP_cut_limit(0.), p_rec_Offset(1.),
+		    Nread(0), N(0), Nw(0), Nspot(0), Nel(0), fW(0), fPovPel(0), fdx(0), fdy(0), fEovP(0) {}
+
+  // a pre-pass event: track (input side of kine, entry 0), HCAL position & BBCAL cluster energy
+  void Add(BBKineBatch const & kine, Double_t hcalX, Double_t hcalY, Double_t clusE) {
+    fIn[0].push_back(kine.p[0]); fIn[1].push_back(kine.px[0]); fIn[2].push_back(kine.py[0]); fIn[3].push_back(kine.pz[0]);
+    fIn[4].push_back(kine.vz[0]); fIn[5].push_back(kine.vy[0]); fIn[6].push_back(kine.tgth[0]); fIn[7].push_back(kine.tgph[0]);
+    fIn[8].push_back(kine.rth[0]); fIn[9].push_back(kine.rph[0]);
+    fHx.push_back(hcalX); fHy.push_back(hcalY); fE.push_back(clusE);
+  }
+  Long64_t GetN() const { return fE.size(); }
+  // histograms to fit in (binning from the configfile), owned by the caller
+  void SetHists(TH1D *hW, TH1D *hPovPel, TH1D *hdx, TH1D *hdy, TH1D *hEovP) {
+    fW = hW; fPovPel = hPovPel; fdx = hdx; fdy = hdy; fEovP = hEovP;
+  }
+
+  // cfg: kinematics w/ the p_rec_Offset of the configfile; pmin/pmax: momentum cuts (0: none)
+  void Estimate(BBKineConfig const & cfg, bool fitOffset, Double_t nsigmaEovP, Double_t pmin, Double_t pmax,
+		Double_t width = 1.5) {
+    N = GetN();
+    BBKineConfig kc = cfg;
+    p_rec_Offset = cfg.pOffset;
+    BBKineBatch kine(std::max(Int_t(N), 1));
+    std::vector<Double_t> * in[] = {&kine.p, &kine.px, &kine.py, &kine.pz, &kine.vz, &kine.vy, &kine.tgth, &kine.tgph, &kine.rth, &kine.rph};
+    for (Int_t k=0; k<10; k++) std::copy(fIn[k].begin(), fIn[k].end(), in[k]->begin());
+    std::vector<char> pok(N), inW(N), inSpot(N);
+    for (Int_t pass=0; pass<(fitOffset ? 2 : 1); pass++) {
+      BBKineCompute(kc, kine, Int_t(N));
+      for (Long64_t i=0; i<N; i++)
+	pok[i] = (pmin <= 0. || kine.p_rec[i] >= pmin) && (pmax <= 0. || kine.p_rec[i] <= pmax);
+      // 1. W, 2. dx & dy in the W window
+      Fill(fW, kine, pok, 0, 0, kW);
+      okW = FitAutoCutPeak(fW, width, W_mean, W_sigma);
+      Nw = Select(kine, pok, inW, kW);
+      Fill(fdx, kine, pok, &inW, 0, kdx);
+      Fill(fdy, kine, pok, &inW, 0, kdy);
+      okPspot = FitAutoCutPeak(fdx, width, dxM, dxS) && FitAutoCutPeak(fdy, width, dyM, dyS);
+      Nspot = Select(kine, pok, inSpot, kSpot);
+      if (pass > 0 || !fitOffset) break;
+      // 3. momentum scale: PovPel peak of the clean elastics to 1
+      Fill(fPovPel, kine, pok, &inW, &inSpot, kPovPel);
+      Double_t m, s;
+      okOffset = FitAutoCutPeak(fPovPel, width, m, s) && m > 0.;
+      if (!okOffset) break;
+      p_rec_Offset = Round(kc.pOffset/m);
+      kc.pOffset = p_rec_Offset;
+    }
+    // 4. PovPel & W in the proton spot, E/p of the elastics
+    if (okPspot) {
+      Fill(fPovPel, kine, pok, &inSpot, 0, kPovPel);
+      okPovPel = FitAutoCutPeak(fPovPel, width, PovPel_mean, PovPel_sigma);
+      Fill(fW, kine, pok, &inSpot, 0, kW);
+      if (FitAutoCutPeak(fW, width, W_mean, W_sigma)) { okW = true; Nw = Select(kine, pok, inW, kW); }
+    }
+    Nel = 0;
+    for (Long64_t i=0; i<N; i++) if (pok[i] && inW[i] && (inSpot[i] || !okPspot)) Nel++;
+    Fill(fEovP, kine, pok, okW ? &inW : 0, okPspot ? &inSpot : 0, kEovP);
+    okEovP = FitAutoCutPeak(fEovP, width, EovP_mean, EovP_sigma);
+    if (okEovP) EovP_cut_limit = fabs(EovP_mean - 1.) + nsigmaEovP*EovP_sigma;
+    Double_t * vals[] = {&W_mean, &W_sigma, &PovPel_mean, &PovPel_sigma, &dxM, &dxS, &dyM, &dyS, &EovP_mean, &EovP_sigma, &EovP_cut_limit};
+    for (std::size_t k=0; k<sizeof(vals)/sizeof(vals[0]); k++) *vals[k] = Round(*vals[k]);
+  }
+
+  // the values as configfile lines (flags & nsigma of the configfile)
+  TString GetCfgLines(bool onW, Double_t nW, bool onPovPel, Double_t nPovPel, bool onSpot, Double_t ndx, Double_t ndy, bool onEovP) const {
+    TString s;
+    if (okW) s += Form("W_cut %d %.6g %.6g %g\n", onW, W_mean, W_sigma, nW);
+    if (okPovPel) s += Form("PovPel_cut %d %.6g %.6g %g\n", onPovPel, PovPel_mean, PovPel_sigma, nPovPel);
+    if (okPspot) s += Form("pspot_cut %d %.6g %.6g %g %.6g %.6g %g\n", onSpot, dxM, dxS, ndx, dyM, dyS, ndy);
+    if (okEovP) s += Form("EovP_cut %d %.6g\n", onEovP, EovP_cut_limit);
+    if (okOffset) s += Form("p_rec_Offset %.6g\n", p_rec_Offset);
+    return s;
+  }
+  // the values, for the cut hash of the run statistics [see calib_run_stats.h]
+  TString GetHashString() const {
+    TString s = "auto_cuts";
+    if (okW) s += Form(" W %.6g %.6g", W_mean, W_sigma);
+    if (okPovPel) s += Form(" PovPel %.6g %.6g", PovPel_mean, PovPel_sigma);
+    if (okPspot) s += Form(" pspot %.6g %.6g %.6g %.6g", dxM, dxS, dyM, dyS);
+    if (okEovP) s += Form(" EovP %.6g", EovP_cut_limit);
+    if (okOffset) s += Form(" p_rec_Offset %.6g", p_rec_Offset);
+    return s;
+  }
+  void Print(std::ostream & out) const {
+    out << Form("Auto cuts: %lld events from %lld entries read, %lld in the W window, %lld in the proton spot, %lld in both",
+		N, Nread, Nw, Nspot, Nel) << "\n";
+    out << (okW ? Form("  W      : %.4f, sigma %.4f GeV", W_mean, W_sigma) : "  W      : no peak, configfile values kept") << "\n";
+    out << (okPspot ? Form("  dx, dy : %.4f, sigma %.4f m; %.4f, sigma %.4f m", dxM, dxS, dyM, dyS)
+	    : "  dx, dy : no peak, configfile values kept") << "\n";
+    out << (okPovPel ? Form("  PovPel : %.4f, sigma %.4f", PovPel_mean, PovPel_sigma) : "  PovPel : no peak, configfile values kept") << "\n";
+    out << (okEovP ? Form("  E/p    : %.4f, sigma %.4f -> |E/p - 1| < %.4f", EovP_mean, EovP_sigma, EovP_cut_limit)
+	    : "  E/p    : no peak, configfile value kept") << "\n";
+    if (okOffset) out << Form("  p_rec_Offset: %.6g", p_rec_Offset) << "\n";
+  }
+  // header w/ the statistics, then the configfile lines
+  bool Write(TString const & fname, TString const & cfglines) const {
+    std::ofstream out(fname.Data());
+    if (!out) { std::cerr << "*!*[WARNING] Can't write " << fname << "\n"; return false; }
+    out << Form("# auto_cuts: %lld events from %lld entries read, %lld in the W window, %lld in the proton spot, %lld in both",
+		N, Nread, Nw, Nspot, Nel) << "\n";
+    if (okEovP) out << Form("# E/p peak %.6g sigma %.6g", EovP_mean, EovP_sigma) << "\n";
+    out << cfglines;
+    return true;
+  }
+  // values written by Write (e.g. by the shard jobs)
+  bool Read(TString const & fname) {
+    std::ifstream in(fname.Data());
+    if (!in) return false;
+    TString line;
+    while (line.ReadLine(in)) {
+      if (line.BeginsWith("#")) continue;
+      TObjArray *tokens = line.Tokenize(" ");
+      Int_t ntokens = tokens->GetEntries();
+      TString skey = ntokens > 0 ? ((TObjString*)(*tokens)[0])->GetString() : "";
+      std::vector<Double_t> v;
+      for (Int_t i=1; i<ntokens; i++) v.push_back(((TObjString*)(*tokens)[i])->GetString().Atof());
+      if (skey == "W_cut" && v.size() > 2) { okW = true; W_mean = v[1]; W_sigma = v[2]; }
+      if (skey == "PovPel_cut" && v.size() > 2) { okPovPel = true; PovPel_mean = v[1]; PovPel_sigma = v[2]; }
+      if (skey == "pspot_cut" && v.size() > 5) { okPspot = true; dxM = v[1]; dxS = v[2]; dyM = v[4]; dyS = v[5]; }
+      if (skey == "EovP_cut" && v.size() > 1) { okEovP = true; EovP_cut_limit = v[1]; }
+      if (skey == "p_rec_Offset" && v.size() > 0) { okOffset = true; p_rec_Offset = v[0]; }
+      delete tokens;
+    }
+    return true;
+  }
+
+private:
+  enum { kW, kPovPel, kdx, kdy, kEovP, kSpot };
+  std::vector<Double_t> fIn[10];   // p, px, py, pz, vz, vy, tg_th, tg_ph, r_th, r_ph
+  std::vector<Double_t> fHx, fHy, fE;
+  TH1D *fW, *fPovPel, *fdx, *fdy, *fEovP;
+
+  static Double_t Round(Double_t x) { return TString(Form("%.6g", x)).Atof(); }
+  Double_t Value(BBKineBatch const & kine, Long64_t i, Int_t what) const {
+    switch (what) {
+    case kW:      return sqrt(std::max(0., kine.W2[i]));
+    case kPovPel: return kine.PovPel[i];
+    case kdx:     return fHx[i] - kine.hcalX_exp[i];
+    case kdy:     return fHy[i] - kine.hcalY_exp[i];
+    default:      return kine.p_rec[i] > 0. ? fE[i]/kine.p_rec[i] : 0.;
+    }
+  }
+  // refills h w/ the events passing the momentum cuts & the given selections (0: none)
+  void Fill(TH1D *h, BBKineBatch const & kine, std::vector<char> const & pok, std::vector<char> const * sel1,
+	    std::vector<char> const * sel2, Int_t what) const {
+    h->Reset();
+    for (Long64_t i=0; i<N; i++) {
+      if (!pok[i] || (sel1 && !(*sel1)[i]) || (sel2 && !(*sel2)[i])) continue;
+      h->Fill(Value(kine, i, what));
+    }
+  }
+  // events in the W window (mean +/- 2 sigma) or the proton spot (ellipse of 2 sigma), all if not fitted
+  Long64_t Select(BBKineBatch const & kine, std::vector<char> const & pok, std::vector<char> & sel, Int_t what) const {
+    Long64_t n = 0;
+    for (Long64_t i=0; i<N; i++) {
+      if (what == kW) sel[i] = !okW || fabs(Value(kine, i, kW) - W_mean) <= 2.*W_sigma;
+      else sel[i] = !okPspot || pow((Value(kine, i, kdx) - dxM)/(2.*dxS), 2) + pow((Value(kine, i, kdy) - dyM)/(2.*dyS), 2) <= 1.;
+      if (sel[i] && pok[i]) n++;
+    }
+    return n;
+  }
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef CALIB_BOOTSTRAP_H
+#define CALIB_BOOTSTRAP_H
+/*
+  Bootstrap uncertainties of the BBCAL gain ratios from the sufficient statistics (M, B) of independent
+  pieces of the data: runs [see calib_run_stats.h] or chunks of a fixed # calibration events. A replica
+  draws as many pieces as there are, w/ replacement, adds up their M & B (times the # draws) and is
+  solved w/ the cells masked in the nominal solution. Replicas are independent & solved in several
+  threads, each from its own random sequence (seed + replica #), so the result doesn't depend on the
+  # threads. Replicas in which another cell has no events or turns degenerate (small pivot) are dropped
+  and counted. W/ a ridge lambda > 0 the replicas are solved like the nominal ridge fit [see calib_ridge.h],
+  (M + lambda I) c = B + lambda, w/ the same lambda. Nothing but the (few hundred) pieces is touched, so it
+  costs seconds.
+  Output files (written next to the gain files):
+    ..._gainRatioErr_sh(ps)...txt : standard deviation of the gain ratio per block (layout of the gain ratio files)
+    ..._bootstrap...txt           : per block mean & std. dev. of the ratio & its most correlated block, plus summary
+  Usage:
+    std::vector<CalibRunStats const *> pieces = ...;           // e.g. one per run
+    CalibBootstrap bs = BootstrapGainRatios(pieces, badCells, nrep, nthreads, minPivotRatio);
+    WriteBootstrapErrors(fname_sh, bs, 0, kNrowsSH, kNcolsSH, cF);
+    WriteBootstrapSummary(fname, bs, kNblksSH, kNcolsSH, kNcolsPS, cF);
+*/
+
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <iostream>
+
+#include "TROOT.h"
+#include "TString.h"
+#include "TRandom3.h"
+#include "TMatrixD.h"
+#include "TVectorD.h"
+#include "calib_run_stats.h"
+#include "sym_sparse_solver.h"
+
+struct CalibBootstrap {
+  Int_t nrep, nused, npieces;
+  std::vector<Double_t> mean, sd;   // gain ratio per cell over the replicas used (bad cells: 1 & 0)
+  TMatrixD corr;                    // correlation of the gain ratios
+};
+
+// nthreads <= 0: all cores
+inline CalibBootstrap BootstrapGainRatios(std::vector<CalibRunStats const *> const & pieces, std::vector<bool> const & badCells,
+					  Int_t nrep, Int_t nthreads, Double_t minPivotRatio, Double_t lambda = 0., UInt_t seed = 4357) {
+  Int_t n = badCells.size(), np = pieces.size();
+  if (nthreads <= 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+  nthreads = std::max(1, std::min(nthreads, nrep));
+  if (nthreads > 1) ROOT::EnableThreadSafety();
+  std::vector<std::vector<Double_t> > ratios(nrep);
+  auto solve = [&](Int_t t) {
+    for (Int_t r=t; r<nrep; r+=nthreads) {
+      TRandom3 rnd(seed + r + 1);
+      std::vector<Int_t> ndraw(np, 0);
+      for (Int_t k=0; k<np; k++) ndraw[rnd.Integer(np)]++;
+      SymSparseMatrix M(n);
+      TVectorD B(n);
+      for (Int_t k=0; k<np; k++) {
+	if (ndraw[k] == 0) continue;
+	M.Add(pieces[k]->M, ndraw[k]);
+	for (Int_t j=0; j<n; j++) B(j) += ndraw[k]*pieces[k]->B(j);
+      }
+      for (Int_t j=0; j<n; j++) {
+	if (badCells[j]) { B(j) = 1.; M.MaskCell(j); }
+	if (lambda > 0.) { B(j) += lambda; M.Add(j, j, lambda); }
+      }
+      SymSparseLDLT ldlt(M);
+      if (!ldlt.IsValid() || !ldlt.GetSmallPivotCells(minPivotRatio).empty()) continue;
+      TVectorD c = ldlt.Solve(B);
+      ratios[r].resize(n);
+      for (Int_t j=0; j<n; j++) ratios[r][j] = badCells[j] ? 1. : c(j);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (Int_t t=1; t<nthreads; t++) threads.push_back(std::thread(solve, t));
+  solve(0);
+  for (std::size_t t=0; t<threads.size(); t++) threads[t].join();
+
+  CalibBootstrap bs;
+  bs.nrep = nrep; bs.nused = 0; bs.npieces = np;
+  bs.mean.assign(n, 0.); bs.sd.assign(n, 0.);
+  bs.corr.ResizeTo(n, n);
+  for (Int_t r=0; r<nrep; r++) {
+    if (ratios[r].empty()) continue;
+    bs.nused++;
+    for (Int_t j=0; j<n; j++) bs.mean[j] += ratios[r][j];
+  }
+  if (bs.nused < 2) return bs;
+  for (Int_t j=0; j<n; j++) bs.mean[j] /= bs.nused;
+  for (Int_t r=0; r<nrep; r++) {
+    if (ratios[r].empty()) continue;
+    std::vector<Double_t> & x = ratios[r];
+    for (Int_t j=0; j<n; j++) x[j] -= bs.mean[j];
+    for (Int_t i=0; i<n; i++) {
+      if (x[i] == 0.) continue;
+      for (Int_t j=0; j<=i; j++) bs.corr(i, j) += x[i]*x[j];
+    }
+  }
+  for (Int_t j=0; j<n; j++) bs.sd[j] = std::sqrt(bs.corr(j, j)/(bs.nused-1));
+  for (Int_t i=0; i<n; i++) {
+    for (Int_t j=0; j<=i; j++) {
+      Double_t c = bs.sd[i] > 0. && bs.sd[j] > 0. ? bs.corr(i, j)/(bs.nused-1)/(bs.sd[i]*bs.sd[j]) : (i == j ? 1. : 0.);
+      bs.corr(i, j) = c; bs.corr(j, i) = c;
+    }
+  }
+  return bs;
+}
+
+// std. dev. of the gain ratios (times scale) of one detector, in the layout of the gain ratio files
+inline void WriteBootstrapErrors(TString const & fname, CalibBootstrap const & bs, Int_t offset, Int_t nrows, Int_t ncols, Double_t scale = 1.) {
+  ofstream out(fname.Data());
+  for (Int_t row=0; row<nrows; row++) {
+    for (Int_t col=0; col<ncols; col++) out << bs.sd[offset + row*ncols + col]*scale << " ";
+    out << std::endl;
+  }
+}
+
+// per block mean & std. dev. of the gain ratio, the most correlated other block & a summary per detector
+inline void WriteBootstrapSummary(TString const & fname, CalibBootstrap const & bs, Int_t nblksSH, Int_t ncolsSH, Int_t ncolsPS,
+				  Double_t scale = 1.) {
+  ofstream out(fname.Data());
+  Int_t n = bs.mean.size();
+  out << "# Bootstrap of the gain ratios: " << bs.nused << " of " << bs.nrep << " replicas used, "
+      << bs.npieces << " pieces (runs or chunks) per replica\n";
+  char const * sdet[2] = {"SH", "PS"};
+  for (Int_t det=0; det<2; det++) {
+    Int_t first = det == 0 ? 0 : nblksSH, last = det == 0 ? nblksSH : n, ncols = det == 0 ? ncolsSH : ncolsPS;
+    Double_t sumrel = 0., maxrel = 0., sumnb = 0.;
+    Int_t nrel = 0, nnb = 0;
+    for (Int_t j=first; j<last; j++) {
+      if (bs.sd[j] <= 0.) continue;
+      Double_t rel = bs.sd[j]/bs.mean[j];
+      sumrel += rel; maxrel = std::max(maxrel, rel); nrel++;
+      // right & lower neighbours
+      Int_t col = (j-first) % ncols;
+      if (col+1 < ncols && bs.sd[j+1] > 0.) { sumnb += bs.corr(j, j+1); nnb++; }
+      if (j+ncols < last && bs.sd[j+ncols] > 0.) { sumnb += bs.corr(j, j+ncols); nnb++; }
+    }
+    out << "# " << sdet[det] << ": mean rel. std. dev. " << (nrel ? 100.*sumrel/nrel : 0.) << "%, max " << 100.*maxrel
+	<< "%, mean correlation w/ neighbours " << (nnb ? sumnb/nnb : 0.) << "\n";
+  }
+  out << "# det blk row col ratio_mean ratio_sd rel_sd(%) max|corr| det_blk(max|corr|)\n";
+  for (Int_t j=0; j<n; j++) {
+    Int_t det = j < nblksSH ? 0 : 1, blk = det == 0 ? j : j-nblksSH, ncols = det == 0 ? ncolsSH : ncolsPS;
+    Int_t jmax = -1;
+    for (Int_t k=0; k<n; k++) if (k != j && bs.sd[k] > 0. && (jmax < 0 || std::fabs(bs.corr(j, k)) > std::fabs(bs.corr(j, jmax)))) jmax = k;
+    Double_t cmax = bs.sd[j] > 0. && jmax >= 0 ? bs.corr(j, jmax) : 0.;
+    out << sdet[det] << " " << blk << " " << blk/ncols << " " << blk%ncols << " "
+	<< bs.mean[j]*scale << " " << bs.sd[j]*scale << " " << (bs.mean[j] != 0. ? 100.*bs.sd[j]/bs.mean[j] : 0.) << " " << cmax;
+    if (bs.sd[j] > 0. && jmax >= 0) out << " " << sdet[jmax < nblksSH ? 0 : 1] << "_" << (jmax < nblksSH ? jmax : jmax-nblksSH);
+    else out << " -";
+    out << "\n";
+  }
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef CALIB_CUT_SCAN_H
+#define CALIB_CUT_SCAN_H
+/*
+  Cut scan for the BBCAL energy calibration: a grid of values for the W, PovPel & proton spot nsigma
+  and the psE & E/p cut limits. All the points are evaluated from the event cache of a single pass
+  over the TChain [see calib_event_cache.h]: one set of sufficient statistics (M, B, # events per
+  cell) is accumulated per grid point, each point is solved for its gain ratios and the E/p peak
+  position & width after calibration is extracted w/ the same Gaussian fit as the main calibration.
+  Scanned cuts are always applied, the other ones as given in the configfile.
+*/
+
+#include <vector>
+#include <iostream>
+
+#include "TF1.h"
+#include "TH1D.h"
+#include "TString.h"
+#include "TVectorD.h"
+#include "TObjArray.h"
+#include "TObjString.h"
+#include "sym_sparse_solver.h"
+#include "calib_event_cache.h"
+#include "calib_gain_solve.h"
+
+struct CalibCutPoint {
+  // cuts
+  bool cut_on_W, cut_on_PovPel, cut_on_pspot, cut_on_psE, cut_on_EovP;
+  Double_t W_mean, W_sigma, W_nsigma;
+  Double_t PovPel_mean, PovPel_sigma, PovPel_nsigma;
+  Double_t pspot_dxM, pspot_dxS, pspot_ndxS, pspot_dyM, pspot_dyS, pspot_ndyS;
+  Double_t psE_cut_limit, EovP_cut_limit;
+  // sufficient statistics & results
+  SymSparseMatrix M;
+  TVectorD B;
+  std::vector<Int_t> nevents_per_cell;
+  Long64_t Ncalibevs;
+  std::vector<Double_t> gratio;      // new/old gain ratio per cell (incl. the cosmic correction factor)
+  Int_t Nbadcells;
+  TH1D *h_EovP;                      // E/p after calibration
+  Double_t mu, muerr, sigma, sigmaerr;
+
+  bool PassElastic(CalibEvRecord const & ev) const {
+    if (cut_on_W && fabs(ev.W - W_mean) > W_sigma*W_nsigma) return false;
+    if (cut_on_PovPel && fabs(ev.PovPel - PovPel_mean) > PovPel_sigma*PovPel_nsigma) return false;
+    if (cut_on_pspot && pow((ev.dx-pspot_dxM) / (pspot_dxS*pspot_ndxS), 2) + pow((ev.dy-pspot_dyM) / (pspot_dyS*pspot_ndyS), 2) > 1.)
+      return false;
+    return true;
+  }
+  bool PassEnergy(Double_t psE, Double_t clusE, Double_t p) const {
+    if (cut_on_psE && psE < psE_cut_limit) return false;
+    if (cut_on_EovP && fabs(clusE/p - 1.) > EovP_cut_limit) return false;
+    return true;
+  }
+};
+
+// values of a "scan_*" configfile line (everything after the key up to a comment)
+inline std::vector<Double_t> GetScanValues(TObjArray const * tokens) {
+  std::vector<Double_t> vals;
+  for (Int_t i=1; i<tokens->GetEntries(); i++) {
+    TString tok = ((TObjString*)(*tokens)[i])->GetString();
+    if (tok.BeginsWith("#")) break;
+    if (tok.IsFloat()) vals.push_back(tok.Atof());
+  }
+  return vals;
+}
+
+// all combinations of the scanned values; an empty list means the value (& switch) of base
+inline std::vector<CalibCutPoint> BuildCutGrid(CalibCutPoint const & base, std::vector<Double_t> const & W_nsig,
+					       std::vector<Double_t> const & PovPel_nsig, std::vector<Double_t> const & pspot_nsig,
+					       std::vector<Double_t> const & psE_lim, std::vector<Double_t> const & EovP_lim) {
+  std::vector<CalibCutPoint> grid(1, base);
+  for (Int_t dim=0; dim<5; dim++) {
+    std::vector<Double_t> const & vals = dim==0 ? W_nsig : dim==1 ? PovPel_nsig : dim==2 ? pspot_nsig : dim==3 ? psE_lim : EovP_lim;
+    if (vals.empty()) continue;
+    std::vector<CalibCutPoint> next;
+    for (std::size_t i=0; i<grid.size(); i++) {
+      for (std::size_t k=0; k<vals.size(); k++) {
+	CalibCutPoint pt = grid[i];
+	if (dim==0) { pt.cut_on_W = true; pt.W_nsigma = vals[k]; }
+	if (dim==1) { pt.cut_on_PovPel = true; pt.PovPel_nsigma = vals[k]; }
+	if (dim==2) { pt.cut_on_pspot = true; pt.pspot_ndxS = vals[k]; pt.pspot_ndyS = vals[k]; }
+	if (dim==3) { pt.cut_on_psE = true; pt.psE_cut_limit = vals[k]; }
+	if (dim==4) { pt.cut_on_EovP = true; pt.EovP_cut_limit = vals[k]; }
+	next.push_back(pt);
+      }
+    }
+    grid = next;
+  }
+  return grid;
+}
+
+// Gaussian fit around the maximum of an E/p histogram (same as for h_EovP_calib)
+inline void FitEovPPeak(TH1D * h, Double_t fitwidth, Double_t & mu, Double_t & muerr, Double_t & sigma, Double_t & sigmaerr) {
+  mu = muerr = sigma = sigmaerr = 0.;
+  if (h->GetEntries() < 10) return;
+  Double_t hmin = h->GetXaxis()->GetXmin(), hmax = h->GetXaxis()->GetXmax();
+  Int_t maxBin = h->GetMaximumBin();
+  Double_t binW = h->GetBinWidth(maxBin), stdev = h->GetStdDev();
+  TF1 fitg(Form("fitg_%s", h->GetName()), "gaus", hmin, hmax);
+  fitg.SetRange(hmin + maxBin*binW - fitwidth*stdev, hmin + maxBin*binW + fitwidth*stdev);
+  fitg.SetParameters(h->GetMaximum(), h->GetMean(), stdev);
+  h->Fit(&fitg, "NQR0");
+  mu = fitg.GetParameter(1); muerr = fitg.GetParError(1);
+  sigma = fitg.GetParameter(2); sigmaerr = fitg.GetParError(2);
+}
+
+#endif
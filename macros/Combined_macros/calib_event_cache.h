@@ -0,0 +1,213 @@
+#ifndef CALIB_EVENT_CACHE_H
+#define CALIB_EVENT_CACHE_H
+/*
+  Compact per-event records for the BBCAL energy calibration. The first pass over the TChain
+  stores, for every event passing the global cut, the few quantities needed to re-apply new
+  gains (cluster blocks, p_rec, track, cut bits, ...). Everything "after calibration" is then
+  computed from this cache instead of re-reading & re-evaluating the whole TChain.
+  Records are packed into fixed size chunks (arena); once the cache exceeds its memory budget
+  the oldest chunks are spilled, in order, to an anonymous temporary file (under $TMPDIR).
+  Usage:
+    CalibEventCache cache(maxMemMB);
+    cache.Append(ev, shBlks, psBlks);                  // pass 1
+    cache.Rewind();
+    while (cache.Next(ev, shBlks, psBlks)) { ... }     // afterwards, any number of times
+  Write()/Read() store the chunks (their used part) in a ROOT directory & append them again, e.g. to pass
+  the cache of a shard job to the merge [see calib_shard.h]. The records are raw memory, so writer &
+  reader must use the same build of the record structs (checked via their sizes).
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <cstring>
+#include <iostream>
+
+#include "TString.h"
+#include "TSystem.h"
+#include "TDirectory.h"
+
+// event level part of a record
+struct CalibEvRecord {
+  enum { kWCut = 1, kPovPelCut = 2, kpCut = 4, kshEdge = 8 }; // cut bits
+  Double_t p_rec;                   // reconstructed momentum (w/ all the offsets)
+  Double_t trX, trY, trTh, trPh;    // first track at the focal plane
+  Double_t dx, dy;                  // HCAL dx & dy
+  Double_t W, PovPel;               // elastic variables (for cut scans)
+  Double_t shE, psE;                // cluster energies as read from the tree
+  Double_t tref;                    // block times are cut relative to it (shClBlkAtime[0] of the 1st loop)
+  UInt_t   rnum;                    // run number
+  Int_t    itrrun;                  // run index (1, 2, ...) as used for the "vs rnum" histograms
+  Short_t  shRowblk, shColblk;      // seed block of the best SH cluster
+  Short_t  psRowblk, psColblk;      // seed block of the best PS cluster
+  UShort_t shNblk, psNblk;          // # CalibBlkRecord's following this record (SH first)
+  UInt_t   cutbits;
+  bool Passed(UInt_t bit) const { return (cutbits & bit) != 0; }
+};
+
+// one block of the best SH/PS cluster (raw, i.e. as read from the tree)
+struct CalibBlkRecord {
+  Double_t e, x, y, atime;
+  Int_t    id;
+  Int_t    pad;
+};
+
+class CalibEventCache {
+public:
+  CalibEventCache(Double_t maxMemMB = 1024., Int_t chunkBytes = 1<<22)
+    : fChunkWords(chunkBytes/8), fMaxChunksInMem(0), fNentries(0), fNspilled(0),
+      fSpill(0), fRdChunk(0), fRdPos(0), fRdLoaded(-1)
+  {
+    fMaxChunksInMem = Long64_t(maxMemMB*1024.*1024./chunkBytes);
+    if (fMaxChunksInMem < 2) fMaxChunksInMem = 2;
+  }
+  ~CalibEventCache() {
+    if (fSpill) fclose(fSpill);
+    for (std::size_t i=0; i<fChunks.size(); i++) delete fChunks[i];
+  }
+
+  Long64_t GetEntries() const { return fNentries; }
+  Long64_t GetNchunks() const { return fNspilled + fChunks.size(); }
+  Double_t GetMemMB() const { return fChunks.size()*fChunkWords*8./1024./1024.; }
+  Double_t GetSpilledMB() const { return fNspilled*fChunkWords*8./1024./1024.; }
+
+  void Append(CalibEvRecord const & ev, CalibBlkRecord const * sh, CalibBlkRecord const * ps) {
+    Long64_t nwords = Words(ev);
+    if (fChunks.empty() || fUsed.back() + nwords > fChunkWords) NewChunk(nwords);
+    Long64_t * buf = &(*fChunks.back())[0] + fUsed.back();
+    memcpy(buf, &ev, sizeof(ev));
+    buf += kEvWords;
+    memcpy(buf, sh, ev.shNblk*sizeof(CalibBlkRecord));
+    buf += ev.shNblk*kBlkWords;
+    memcpy(buf, ps, ev.psNblk*sizeof(CalibBlkRecord));
+    fUsed.back() += nwords;
+    fNentries++;
+  }
+
+  // start reading from the first record
+  void Rewind() { fRdChunk = 0; fRdPos = 0; fRdLoaded = -1; }
+
+  // reads the next record; block pointers stay valid until the next call
+  bool Next(CalibEvRecord & ev, CalibBlkRecord const *& sh, CalibBlkRecord const *& ps) {
+    while (true) {
+      if (fRdChunk >= GetNchunks()) return false;
+      Long64_t const * buf = LoadChunk(fRdChunk);
+      if (fRdPos < ChunkUsed(fRdChunk)) {
+	buf += fRdPos;
+	memcpy(&ev, buf, sizeof(ev));
+	sh = (CalibBlkRecord const *)(buf + kEvWords);
+	ps = sh + ev.shNblk;
+	fRdPos += Words(ev);
+	return true;
+      }
+      fRdChunk++; fRdPos = 0;
+    }
+  }
+
+  // writes the chunks as vector<Long64_t> "<name>_<ichunk>", numbered on from ichunk; returns # written
+  Long64_t Write(TDirectory * dir, char const * name, Long64_t ichunk = 0) {
+    Long64_t nwritten = 0;
+    for (Long64_t c=0; c<GetNchunks(); c++) {
+      Long64_t const * buf = LoadChunk(c);
+      std::vector<Long64_t> v(buf, buf + ChunkUsed(c));
+      if (dir->WriteObject(&v, Form("%s_%lld", name, ichunk + c)) <= 0) {
+	std::cerr << "*!*[ERROR] Writing the event cache to " << dir->GetName() << " failed!\n";
+	std::exit(1);
+      }
+      nwritten++;
+    }
+    Rewind();
+    return nwritten;
+  }
+  // appends the records of chunks "<name>_<first>" ... "<name>_<first+nchunks-1>"
+  void Read(TDirectory * dir, char const * name, Long64_t first, Long64_t nchunks) {
+    for (Long64_t c=first; c<first+nchunks; c++) {
+      std::vector<Long64_t> * v = 0;
+      dir->GetObject(Form("%s_%lld", name, c), v);
+      if (!v) {
+	std::cerr << "*!*[ERROR] Event cache chunk " << name << "_" << c << " missing in " << dir->GetName() << "\n";
+	std::exit(1);
+      }
+      for (std::size_t pos=0; pos<v->size(); ) {
+	CalibEvRecord ev;
+	memcpy(&ev, &(*v)[pos], sizeof(ev));
+	CalibBlkRecord const * sh = (CalibBlkRecord const *)(&(*v)[pos] + kEvWords);
+	Append(ev, sh, sh + ev.shNblk);
+	pos += Words(ev);
+      }
+      delete v;
+    }
+  }
+
+private:
+  enum { kEvWords = (sizeof(CalibEvRecord)+7)/8, kBlkWords = (sizeof(CalibBlkRecord)+7)/8 };
+  typedef std::vector<Long64_t> Chunk; // 8 byte words keep the doubles aligned
+
+  static Long64_t Words(CalibEvRecord const & ev) {
+    return kEvWords + (ev.shNblk + ev.psNblk)*Long64_t(kBlkWords);
+  }
+
+  void NewChunk(Long64_t nwords) {
+    if (nwords > fChunkWords) fChunkWords = nwords; // never split a record
+    if (Long64_t(fChunks.size()) >= fMaxChunksInMem) Spill();
+    fChunks.push_back(new Chunk(fChunkWords));
+    fUsed.push_back(0);
+  }
+
+  // moves the oldest in-memory chunk to the temporary file
+  void Spill() {
+    if (!fSpill) {
+      TString fname = "bbcal_calib_cache";
+      fSpill = gSystem->TempFileName(fname);
+      if (!fSpill) {
+	std::cerr << "*!*[ERROR] Could not create a temporary file for the event cache!\n";
+	std::exit(1);
+      }
+      gSystem->Unlink(fname); // goes away w/ the process, whatever happens
+      std::cout << " Event cache exceeds its memory budget, spilling to temporary file.\n";
+    }
+    Chunk * c = fChunks.front();
+    Long64_t used = fUsed.front();
+    fseek(fSpill, 0, SEEK_END);
+    if (fwrite(&used, sizeof(used), 1, fSpill) != 1 ||
+	fwrite(&(*c)[0], sizeof(Long64_t), used, fSpill) != std::size_t(used)) {
+      std::cerr << "*!*[ERROR] Writing the event cache to the temporary file failed!\n";
+      std::exit(1);
+    }
+    fSpillOffset.push_back(ftell(fSpill) - (used+1)*Long64_t(sizeof(Long64_t)));
+    fSpillUsed.push_back(used);
+    delete c;
+    fChunks.erase(fChunks.begin());
+    fUsed.erase(fUsed.begin());
+    fNspilled++;
+  }
+
+  Long64_t ChunkUsed(Long64_t ichunk) const {
+    return ichunk < fNspilled ? fSpillUsed[ichunk] : fUsed[ichunk-fNspilled];
+  }
+
+  Long64_t const * LoadChunk(Long64_t ichunk) {
+    if (ichunk >= fNspilled) return &(*fChunks[ichunk-fNspilled])[0];
+    if (ichunk != fRdLoaded) {
+      fRdBuf.resize(fSpillUsed[ichunk] + 1);
+      fseek(fSpill, fSpillOffset[ichunk] + sizeof(Long64_t), SEEK_SET);
+      if (fread(&fRdBuf[0], sizeof(Long64_t), fSpillUsed[ichunk], fSpill) != std::size_t(fSpillUsed[ichunk])) {
+	std::cerr << "*!*[ERROR] Reading the event cache from the temporary file failed!\n";
+	std::exit(1);
+      }
+      fRdLoaded = ichunk;
+    }
+    return &fRdBuf[0];
+  }
+
+  Long64_t fChunkWords, fMaxChunksInMem;
+  Long64_t fNentries, fNspilled;
+  std::vector<Chunk*> fChunks;          // in-memory chunks (the newest ones)
+  std::vector<Long64_t> fUsed;          // # words used in each of them
+  FILE * fSpill;                        // spilled chunks (the oldest ones)
+  std::vector<Long64_t> fSpillOffset, fSpillUsed;
+  Long64_t fRdChunk, fRdPos, fRdLoaded;
+  Chunk fRdBuf;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef CALIB_GAIN_SOLVE_H
+#define CALIB_GAIN_SOLVE_H
+/*
+  Solve of the calorimeter gain fit M c = B for the gain ratios c (new/old), shared by bbcal_eng_calib_w_h2.C,
+  combine_run_stats.C, bbcal_calib_stream.C, the cut scan, calib_shEng_w_known_psEng.C &
+  hcal/hcal_eng_cal_PD.C so they all leave out the cells the same way:
+    1. bad cells (fewer than Nmin events or M_jj < minMBratio*B_j; for the ridge solve only the ones w/o
+       events) are masked: their row & column of M are zeroed, M_jj = B_j = 1
+    2. M is factorized w/ LDL^T; cells w/ a pivot ratio below minPivotRatio are (nearly) degenerate w/ their
+       neighbours, so they are masked too & M refactorized, until none is left (at most 10 rounds; a warning
+       if there still are some after the last one)
+  Bad cells get ratio 1.
+  Usage:
+    std::vector<bool> badCells;
+    MaskBadCells(M, B, nevents_per_cell, Nmin, minMBratio, ridge, badCells);   // std::vector or array
+    SymSparseLDLT ldlt;
+    Int_t ndeg = FactorizeGainMatrix(M, B, minPivotRatio, badCells, ldlt, BBCalCellName);   // w/ a name: print the cells
+    CoeffR = ldlt.Solve(B);
+  or w/o the intermediate steps: CoeffR = SolveGainRatios(M, B, nevents_per_cell, Nmin, minMBratio, minPivotRatio, badCells);
+*/
+
+#include <vector>
+#include <iostream>
+
+#include "TString.h"
+#include "TVectorD.h"
+#include "sym_sparse_solver.h"
+
+// name of a cell in the messages
+typedef TString (*GainCellName)(Int_t cell);
+// BBCAL fits: cells 0-188 are the SH blocks, 189-240 the PS ones
+inline TString BBCalCellName(Int_t cell) { return cell < 189 ? Form("SH %d", cell) : Form("PS %d", cell-189); }
+
+// step 1 (M & B are masked in place); onlyEmpty: only the cells w/o events (ridge solve)
+inline void MaskBadCells(SymSparseMatrix & M, TVectorD & B, Int_t const * nevents_per_cell, Int_t Nmin,
+			 Double_t minMBratio, bool onlyEmpty, std::vector<bool> & badCells) {
+  Int_t n = M.GetNrows();
+  badCells.assign(n, false);
+  for (Int_t j=0; j<n; j++) {
+    if (onlyEmpty ? nevents_per_cell[j] == 0 : (nevents_per_cell[j] < Nmin || M(j,j) < minMBratio*B(j))) {
+      B(j) = 1.; M.MaskCell(j); badCells[j] = true;
+    }
+  }
+}
+inline void MaskBadCells(SymSparseMatrix & M, TVectorD & B, std::vector<Int_t> const & nevents_per_cell, Int_t Nmin,
+			 Double_t minMBratio, bool onlyEmpty, std::vector<bool> & badCells) {
+  MaskBadCells(M, B, &nevents_per_cell[0], Nmin, minMBratio, onlyEmpty, badCells);
+}
+
+// step 2: ldlt of the final M; returns the # degenerate cells masked. W/ a cell name they are printed.
+inline Int_t FactorizeGainMatrix(SymSparseMatrix & M, TVectorD & B, Double_t minPivotRatio, std::vector<bool> & badCells,
+				 SymSparseLDLT & ldlt, GainCellName name = 0) {
+  Int_t const nround = 10;
+  Int_t ndeg = 0;
+  ldlt = SymSparseLDLT(M);
+  for (Int_t itr = 0; itr<=nround; itr++) {
+    std::vector<Int_t> degCells = ldlt.GetSmallPivotCells(minPivotRatio);
+    if (degCells.empty()) break;
+    if (itr == nround) {   // the factorization after the last round still has some
+      std::cout << "*!*[WARNING] " << degCells.size() << " cell(s) still numerically degenerate after " << nround
+		<< " rounds of exclusion, the gain ratios are unreliable.\n";
+      break;
+    }
+    for (std::size_t k = 0; k<degCells.size(); k++) {
+      Int_t j = degCells[k];
+      if (name)
+	std::cout << "*!*[WARNING] Numerically degenerate cell: " << name(j) << " (pivot ratio " << ldlt.GetPivotRatio(j)
+		  << "). Excluding it.\n";
+      B(j) = 1.; M.MaskCell(j); badCells[j] = true;
+      ndeg++;
+    }
+    ldlt = SymSparseLDLT(M);
+  }
+  return ndeg;
+}
+
+// both steps on copies of M & B, quietly
+inline TVectorD SolveGainRatios(SymSparseMatrix M, TVectorD B, std::vector<Int_t> const & nevents_per_cell, Int_t Nmin,
+				Double_t minMBratio, Double_t minPivotRatio, std::vector<bool> & badCells) {
+  MaskBadCells(M, B, nevents_per_cell, Nmin, minMBratio, false, badCells);
+  SymSparseLDLT ldlt;
+  FactorizeGainMatrix(M, B, minPivotRatio, badCells, ldlt);
+  TVectorD CoeffR = ldlt.Solve(B);
+  for (Int_t j=0; j<M.GetNrows(); j++) if (badCells[j]) CoeffR(j) = 1.;
+  return CoeffR;
+}
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef CALIB_HIST_REGISTRY_H
+#define CALIB_HIST_REGISTRY_H
+/*
+  Histogram registry for the BBCAL energy calibration. Diagnostic histograms belong to groups which
+  can be switched on & off from the configfile ("diag_hists"); a histogram of a disabled group is
+  never created (Book() returns 0), so it costs neither memory nor filling time. The macro checks
+  the group flag before filling/drawing. Booked histograms are written in booking order, except
+  the helper ones booked w/ BookTmp() (e.g. sums later divided by counts). The "vs run #" ones are
+  booked as run-indexed accumulators (BookRun(), see bbcal_run_hist.h) & turned into TH2D (& TProfile)
+  w/ one bin per run by MakeRunHists() once the # runs is known; they are written after the others.
+  Groups:
+    main     : E/p & cluster energies, E/p & energy per block, E/p vs p, # events per block
+    kine     : W, Q2, p/p_el, p vs theta, bend angle (mom_calib)
+    timing   : ADC time differences w/in the SH & PS clusters
+    run      : E/p, cluster size & multiplicity, p/p_el vs run #
+    tracking : E/p vs track variables & positions, cluster - track position differences
+    pspot    : HCAL dx vs dy
+  Usage:
+    CalibHistRegistry hists;
+    hists.Configure(tokens);                          // "diag_hists main kine", "all" or "none"
+    TH1D *h = hists.Book<TH1D>("main", "h_EovP", "E/p", 200, 0., 2.);
+    if (hists.On("main")) h->Fill(...);
+    BBRunHist *rh = hists.BookRun("run", "h2_EovP_vs_rnum", "E/p vs Run no", 200, 0.4, 1.6,
+                                  "h2_EovP_vs_rnum_prof", "E/p vs Run no. (Profile)", 0.4, 1.6, "S");
+    ...
+    hists.MakeRunHists(lrnum.size());
+    TH2D *h2 = hists.Get<TH2D>("h2_EovP_vs_rnum");
+    hists.Write();
+*/
+
+#include <set>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include "TH1.h"
+#include "TH2.h"
+#include "TString.h"
+#include "TObjArray.h"
+#include "TObjString.h"
+#include "bbcal_run_hist.h"
+
+class CalibHistRegistry {
+public:
+  CalibHistRegistry() : fRunMade(false) {
+    char const * groups[] = {"main", "kine", "timing", "run", "tracking", "pspot"};
+    for (std::size_t i=0; i<sizeof(groups)/sizeof(groups[0]); i++) fGroups.push_back(groups[i]);
+    fOn.insert(fGroups.begin(), fGroups.end());
+  }
+
+  // configfile tokens: key followed by group names, "all" or "none" (everything up to a comment)
+  void Configure(TObjArray const * tokens) {
+    fOn.clear();
+    for (Int_t i=1; i<tokens->GetEntries(); i++) {
+      TString g = ((TObjString*)(*tokens)[i])->GetString();
+      if (g.BeginsWith("#")) break;
+      if (g == "none") { fOn.clear(); continue; }
+      if (g == "all") { fOn.insert(fGroups.begin(), fGroups.end()); continue; }
+      if (std::find(fGroups.begin(), fGroups.end(), g) == fGroups.end()) {
+	std::cerr << "*!*[ERROR] Unknown histogram group \"" << g << "\" in diag_hists! Known groups:";
+	for (std::size_t k=0; k<fGroups.size(); k++) std::cerr << " " << fGroups[k];
+	std::cerr << "\n";
+	std::exit(1);
+      }
+      fOn.insert(g);
+    }
+  }
+  void Enable(TString const & group, bool on = true) { if (on) fOn.insert(group); else fOn.erase(group); }
+  void DisableAll() { fOn.clear(); }
+  bool On(TString const & group) const { return fOn.count(group) > 0; }
+  TString GetEnabled() const {
+    TString s;
+    for (std::size_t i=0; i<fGroups.size(); i++) if (On(fGroups[i])) s += (s.IsNull() ? "" : " ") + fGroups[i];
+    return s.IsNull() ? TString("none") : s;
+  }
+
+  // creates the histogram if its group is enabled (0 otherwise)
+  template<class T, class... Args> T * Book(TString const & group, Args... args) { return Add<T>(group, true, args...); }
+  // same, but not written out by Write()
+  template<class T, class... Args> T * BookTmp(TString const & group, Args... args) { return Add<T>(group, false, args...); }
+
+  // the booked ones out of the given list
+  static std::vector<TH1*> Booked(std::vector<TH1*> const & hists) {
+    std::vector<TH1*> out;
+    for (std::size_t i=0; i<hists.size(); i++) if (hists[i]) out.push_back(hists[i]);
+    return out;
+  }
+
+  // run-indexed histogram (w/ a profile if pname is given), 0 if its group is disabled
+  BBRunHist * BookRun(TString const & group, char const * name, char const * title, Int_t nbinsy, Double_t ymin, Double_t ymax,
+		      char const * pname = 0, char const * ptitle = "", Double_t pylow = 0., Double_t pyup = 0., char const * popt = "") {
+    if (!On(group)) return 0;
+    BBRunHist *rh = new BBRunHist(name, title, nbinsy, ymin, ymax);
+    if (pname) rh->SetProfile(pname, ptitle, pylow, pyup, popt);
+    fRunHists.push_back(rh);
+    return rh;
+  }
+  std::vector<BBRunHist*> const & GetRunHists() const { return fRunHists; }
+  // turns the run-indexed histograms into TH2D's (& TProfile's) w/ (at least) nruns bins
+  void MakeRunHists(Int_t nruns) {
+    if (fRunMade) return;
+    fRunMade = true;
+    for (std::size_t i=0; i<fRunHists.size(); i++) {
+      fHists.push_back(fRunHists[i]->MakeTH2<TH2D>(nruns));
+      fWrite.push_back(true);
+      TProfile *p = fRunHists[i]->MakeProfile(nruns);
+      if (!p) continue;
+      fHists.push_back(p);
+      fWrite.push_back(true);
+    }
+  }
+
+  // booked histogram by name (0 if not booked)
+  template<class T> T * Get(char const * name) const {
+    for (std::size_t i=0; i<fHists.size(); i++) if (!strcmp(fHists[i]->GetName(), name)) return (T*)fHists[i];
+    return 0;
+  }
+
+  Int_t GetNbooked() const { return fHists.size() + (fRunMade ? 0 : fRunHists.size()); }
+  // writes all the booked histograms (but the temporary ones) to the current directory
+  void Write() const {
+    for (std::size_t i=0; i<fHists.size(); i++) if (fWrite[i]) fHists[i]->Write();
+  }
+
+private:
+  std::vector<TString> fGroups;    // known groups
+  std::set<TString> fOn;           // enabled ones
+  std::vector<TH1*> fHists;        // booked histograms (in booking order)
+  std::vector<bool> fWrite;
+  std::vector<BBRunHist*> fRunHists;  // run-indexed ones
+  bool fRunMade;                      // converted to TH2D's (MakeRunHists)
+
+  template<class T, class... Args> T * Add(TString const & group, bool write, Args... args) {
+    if (!On(group)) return 0;
+    T *h = new T(args...);
+    fHists.push_back(h);
+    fWrite.push_back(write);
+    return h;
+  }
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef CALIB_PARALLEL_H
+#define CALIB_PARALLEL_H
+/*
+  Helpers to run the event loop of the BBCAL energy calibration in several threads. The list of ROOT
+  files is split into contiguous pieces w/ similar # entries, one per worker. Every worker owns its
+  TChain, global cut formula, branch buffers (set up by the macro), histograms, output tree, event
+  cache, per-run statistics & counters. After the loop everything is merged in worker order, so for a
+  given # threads the result doesn't depend on thread scheduling, and Tout & the event cache keep
+  the order of the TChain. The merge of process-level shards loads one shard file per worker & then
+  merges the same way [see calib_shard.h].
+*/
+
+#include <map>
+#include <vector>
+#include <atomic>
+#include <iostream>
+
+#include "TH1.h"
+#include "TCut.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TChain.h"
+#include "TString.h"
+#include "TSystem.h"
+#include "TMatrixD.h"
+#include "TVectorD.h"
+#include "calib_event_cache.h"
+#include "calib_run_stats.h"
+#include "bbcal_global_cut.h"
+#include "bbcal_branch_usage.h"
+#include "bbcal_chain_reader.h"
+#include "bbcal_event_sampler.h"
+#include "calib_pipeline.h"
+#include "bbcal_run_hist.h"
+
+struct CalibFileInfo {
+  TString  name;
+  UInt_t   rnum;
+  Long64_t nentries;
+  Int_t    itrrun;   // run index (1, 2, ...) in the order of the TChain
+};
+
+// expands a run list entry & gets run number & # entries of every file
+inline std::vector<CalibFileInfo> ScanRootFiles(TString const & pattern) {
+  std::vector<CalibFileInfo> infos;
+  std::vector<TString> files = ExpandRootFiles(pattern);
+  for (std::size_t i=0; i<files.size(); i++) {
+    CalibFileInfo info;
+    info.name = files[i];
+    info.rnum = GetFileRunNumber(files[i], &info.nentries);
+    info.itrrun = 0;
+    infos.push_back(info);
+  }
+  return infos;
+}
+
+// splits files into (at most) nparts contiguous pieces w/ ~equal # entries: a new piece starts at the file
+// whose middle entry lies beyond the current piece's share. Returns the index of the first file of each
+// piece, followed by files.size().
+inline std::vector<Int_t> PartitionFiles(std::vector<CalibFileInfo> const & files, Int_t nparts) {
+  Long64_t ntot = 0;
+  for (std::size_t i=0; i<files.size(); i++) ntot += files[i].nentries;
+  std::vector<Int_t> first(1, 0);
+  Long64_t nsum = 0;
+  for (std::size_t i=0; i<files.size(); i++) {
+    Int_t part = first.size();
+    Int_t nleft = files.size() - i; // incl. this one
+    if (part < nparts && Int_t(i) > first.back() &&
+	(2*nsum + files[i].nentries > 2*ntot*part/nparts || nleft <= nparts - part))
+      first.push_back(i);
+    nsum += files[i].nentries;
+  }
+  first.push_back(files.size());
+  return first;
+}
+
+class CalibWorker {
+public:
+  Int_t id;
+  TChain *C;
+  BBGlobalCut *GlobalCut;
+  BBBranchUsage branches;          // branches read from C & I/O statistics
+  BBChainReader reader;            // tree cache & prefetch of C
+  BBEventSampler sampler;          // entries of C to read (all w/o sampling)
+  std::vector<Int_t> fileItrrun;   // run index of every file in C (empty if not known in advance)
+  TTree *Tout;                     // worker 0 fills the output tree itself, others a temporary one
+  TFile *ftmp;
+  TFile *fshard;                   // shard file loaded into this worker (shard merge only)
+  CalibEventCache evcache;
+  std::map<UInt_t, CalibRunStats> runstats;
+  std::vector<CalibRunStats> bootstats;   // M & B in chunks of a fixed # events (bootstrap w/ chunks only)
+  TMatrixD M_chk;                  // dense check (check_sparse_accum 1 only)
+  TVectorD B_chk;
+  Long64_t Ngoodevs, Nelasevs, Nprocessed;
+  Double_t realtime, cputime;
+  CalibStageTime tread, tcompute, twrite;   // busy & idle time of the pipeline stages (pipeline only)
+  std::atomic<Long64_t> * ntotal;  // # events processed by all workers (progress report)
+
+  CalibWorker(Int_t i, TChain *c, TCut const & gcut, Double_t cachemem, Int_t ndense)
+    : id(i), C(c), Tout(0), ftmp(0), fshard(0), evcache(cachemem), M_chk(ndense, ndense), B_chk(ndense),
+      Ngoodevs(0), Nelasevs(0), Nprocessed(0), realtime(0.), cputime(0.), ntotal(0)
+  {
+    GlobalCut = new BBGlobalCut(Form("GlobalCut%d",i), gcut);  // bound to C in the event loop
+  }
+  ~CalibWorker() {
+    delete GlobalCut;
+    if (ftmp) {
+      TString fname = ftmp->GetName();
+      ftmp->Close(); delete ftmp;
+      gSystem->Unlink(fname);
+    }
+    if (fshard) { fshard->Close(); delete fshard; }
+  }
+
+  // worker 0 works on the histograms themselves, the others on private clones
+  void SetHists(std::vector<TH1*> const & hists) {
+    for (std::size_t i=0; i<hists.size(); i++) {
+      TH1 *h = hists[i];
+      if (id > 0) { h = (TH1*)hists[i]->Clone(); h->SetDirectory(0); }
+      fHists[hists[i]->GetName()] = std::make_pair(hists[i], h);
+    }
+  }
+  // 0 if the histogram wasn't booked (disabled group)
+  template<class T> T * Hist(char const * name) {
+    std::map<TString, std::pair<TH1*,TH1*> >::iterator it = fHists.find(name);
+    return it == fHists.end() ? 0 : (T*)it->second.second;
+  }
+  // same for the run-indexed histograms (private copies are empty, so cheap to make & to merge)
+  void SetRunHists(std::vector<BBRunHist*> const & hists) {
+    for (std::size_t i=0; i<hists.size(); i++) {
+      BBRunHist *h = id > 0 ? new BBRunHist(*hists[i]) : hists[i];
+      fRunHists[hists[i]->GetName()] = std::make_pair(hists[i], h);
+    }
+  }
+  BBRunHist * RunHist(char const * name) {
+    std::map<TString, std::pair<BBRunHist*,BBRunHist*> >::iterator it = fRunHists.find(name);
+    return it == fRunHists.end() ? 0 : it->second.second;
+  }
+  void MergeHists() {
+    if (id == 0) return;
+    for (std::map<TString, std::pair<TH1*,TH1*> >::iterator it = fHists.begin(); it != fHists.end(); ++it) {
+      if (!it->second.second) continue;
+      it->second.first->Add(it->second.second);
+      delete it->second.second;
+      it->second.second = 0;
+    }
+    for (std::map<TString, std::pair<BBRunHist*,BBRunHist*> >::iterator it = fRunHists.begin(); it != fRunHists.end(); ++it) {
+      if (!it->second.second) continue;
+      it->second.first->Add(*it->second.second);
+      delete it->second.second;
+      it->second.second = 0;
+    }
+  }
+
+  // worker 0 fills the given output tree, the others a tree in a temporary file
+  void SetTree(TTree *T) {
+    if (id == 0) { Tout = T; return; }
+    TDirectory *savdir = gDirectory;
+    ftmp = TFile::Open(Form("%s/bbcal_calib_tout_%d_%d.root", gSystem->TempDirectory(), gSystem->GetPid(), id), "RECREATE");
+    if (ftmp && T->GetCurrentFile()) ftmp->SetCompressionSettings(T->GetCurrentFile()->GetCompressionSettings());   // keeps the fast copy
+    Tout = new TTree(T->GetName(), T->GetTitle());
+    Tout->SetMaxTreeSize(T->GetMaxTreeSize());
+    Tout->SetAutoFlush(T->GetAutoFlush());
+    savdir->cd();
+  }
+  // appends the entries of the temporary (or shard) tree to the output tree (in the order of the workers)
+  void MergeTree(TTree *T) {
+    if (!Tout || Tout == T) return;
+    Tout->ResetBranchAddresses();
+    T->CopyEntries(Tout, -1, "", kTRUE);
+    delete Tout; Tout = 0;
+  }
+
+private:
+  std::map<TString, std::pair<TH1*,TH1*> > fHists; // name -> (original, private copy)
+  std::map<TString, std::pair<BBRunHist*,BBRunHist*> > fRunHists;
+};
+
+// iterates over the event caches of all the workers in order
+inline bool NextCachedEvent(std::vector<CalibWorker*> & workers, std::size_t & iw, CalibEvRecord & ev,
+			    CalibBlkRecord const *& sh, CalibBlkRecord const *& ps) {
+  while (iw < workers.size()) {
+    if (workers[iw]->evcache.Next(ev, sh, ps)) return true;
+    if (++iw < workers.size()) workers[iw]->evcache.Rewind();
+  }
+  return false;
+}
+
+#endif
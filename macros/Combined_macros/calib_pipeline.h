@@ -0,0 +1,208 @@
+#ifndef CALIB_PIPELINE_H
+#define CALIB_PIPELINE_H
+/*
+  Pipeline stages for the event loop of the BBCAL energy calibration. W/ "pipeline 1" every worker
+  runs three threads connected by bounded FIFOs of reusable records:
+    read:    C->GetEntry, tree changes & global cut; the branch buffers go into a record
+    compute: the record is copied into the macro's variables, then kinematics, cuts, histograms,
+             run statistics & event cache as before; the Tout values go into a record
+    write:   the record is copied into the Tout buffers & Tout->Fill() serialises & compresses it
+  The stages overlap, the order of the events is kept (one thread per stage), so the results are
+  the same as w/o pipeline. Each stage records its busy & idle time (waiting for the neighbouring
+  stage): a busy read stage means the job is I/O-bound, compute: CPU-bound, write: output-bound.
+  CalibBufferSet holds the branch buffers of a tree: the macro's own (where it binds & reads them)
+  & a private copy the tree is bound to instead (read side of C, write side of Tout). Records only
+  hold the part of variable size arrays that is filled for the entry.
+  Usage:
+    CalibBufferSet rbufs;
+    rbufs.Add(C, name, addr) ...; rbufs.BindPrivate(C);   // before BBGlobalCut::Bind
+    CalibPipe pipe(depth);
+    // read stage:    r = pipe.Acquire(); C->LoadTree(entry); rbufs.UpdateLeaves(C) on tree change; C->GetEntry(entry);
+    //                rbufs.Save(r->data, false); pipe.Push(r);
+    // compute stage: while ((r = pipe.Pop())) { rbufs.Load(r->data, true); ...; pipe.Release(r); }
+*/
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <condition_variable>
+
+#include "TTree.h"
+#include "TLeaf.h"
+#include "TString.h"
+#include "TBranch.h"
+
+// busy & idle time of a stage (s)
+struct CalibStageTime {
+  Double_t busy, idle;
+  CalibStageTime() : busy(0.), idle(0.) {}
+  void Add(CalibStageTime const & o) { busy += o.busy; idle += o.idle; }
+};
+
+// bounded FIFO of reusable records between two stages, w/ the time both sides waited
+class CalibPipe {
+public:
+  struct Record {
+    std::vector<char> data;
+    Long64_t entry;     // chain entry (read stage)
+    Int_t treenum;
+    bool passed;        // global cut
+  };
+
+  CalibPipe(Int_t depth) : fRecords(depth > 0 ? depth : 1), fClosed(false), fWaitPush(0.), fWaitPop(0.) {
+    for (std::size_t i=0; i<fRecords.size(); i++) fFree.push_back(&fRecords[i]);
+  }
+
+  // producer: a free record (waits for one)
+  Record * Acquire() {
+    std::unique_lock<std::mutex> lock(fMutex);
+    if (fFree.empty()) {
+      Clock::time_point t0 = Clock::now();
+      fCond.wait(lock, [this] { return !fFree.empty(); });
+      fWaitPush += Seconds(t0);
+    }
+    Record *r = fFree.front(); fFree.pop_front();
+    return r;
+  }
+  void Push(Record *r) {
+    { std::lock_guard<std::mutex> lock(fMutex); fFull.push_back(r); }
+    fCond.notify_all();
+  }
+  // producer: no more records
+  void Close() {
+    { std::lock_guard<std::mutex> lock(fMutex); fClosed = true; }
+    fCond.notify_all();
+  }
+  // consumer: the next record (waits for one), 0 once closed & empty
+  Record * Pop() {
+    std::unique_lock<std::mutex> lock(fMutex);
+    if (fFull.empty() && !fClosed) {
+      Clock::time_point t0 = Clock::now();
+      fCond.wait(lock, [this] { return !fFull.empty() || fClosed; });
+      fWaitPop += Seconds(t0);
+    }
+    if (fFull.empty()) return 0;
+    Record *r = fFull.front(); fFull.pop_front();
+    return r;
+  }
+  void Release(Record *r) {
+    { std::lock_guard<std::mutex> lock(fMutex); fFree.push_back(r); }
+    fCond.notify_all();
+  }
+
+  Double_t GetWaitPush() const { return fWaitPush; }   // producer idle
+  Double_t GetWaitPop() const { return fWaitPop; }     // consumer idle
+
+private:
+  typedef std::chrono::steady_clock Clock;
+  static Double_t Seconds(Clock::time_point t0) { return std::chrono::duration<Double_t>(Clock::now() - t0).count(); }
+
+  std::vector<Record> fRecords;
+  std::deque<Record*> fFree, fFull;
+  std::mutex fMutex;
+  std::condition_variable fCond;
+  bool fClosed;
+  Double_t fWaitPush, fWaitPop;
+};
+
+// branch buffers of a tree: the macro's & a private copy the tree reads into (writes from)
+class CalibBufferSet {
+public:
+  // a branch bound by the macro to addr (T: the tree, for the leaf type & max. length)
+  void Add(TTree *T, TString const & name, void *addr) {
+    TLeaf *leaf = T->GetLeaf(name);
+    if (!leaf || !addr) return;
+    for (std::size_t i=0; i<fBufs.size(); i++) if (fBufs[i].name == name) return;
+    Buf b;
+    b.name = name; b.user = (char*)addr; b.leaf = leaf;
+    b.typesize = TypeSize(leaf);
+    b.isarray = leaf->GetLeafCount() != 0;
+    b.priv.assign(MaxBytes(b), 0);
+    fBufs.push_back(b);
+  }
+  // all branches of T, w/ the addresses given at Branch() (e.g. Tout)
+  void AddAll(TTree *T) {
+    TObjArray *branches = T->GetListOfBranches();
+    for (Int_t i=0; i<branches->GetEntriesFast(); i++) {
+      TBranch *br = (TBranch*)branches->UncheckedAt(i);
+      Add(T, br->GetName(), br->GetAddress());
+    }
+  }
+  // binds the branches of T to the private buffers
+  void BindPrivate(TTree *T) {
+    for (std::size_t i=0; i<fBufs.size(); i++) T->SetBranchAddress(fBufs[i].name, &fBufs[i].priv[0]);
+  }
+  // to be called when (the chain) T has loaded a new tree (LoadTree), before its first entry is read: the
+  // private buffers are sized for the leaf counts of that tree. Returns true if a private buffer had to
+  // grow & was bound again (anything sharing it, e.g. BBGlobalCut, must pick up the new address).
+  bool UpdateLeaves(TTree *T) {
+    bool rebound = false;
+    for (std::size_t i=0; i<fBufs.size(); i++) {
+      Buf & b = fBufs[i];
+      b.leaf = T->GetLeaf(b.name);
+      if (!b.leaf) continue;
+      std::size_t n = MaxBytes(b);
+      if (n > b.priv.size()) {
+	b.priv.assign(std::max(n, 2*b.priv.size()), 0);
+	T->SetBranchAddress(b.name, &b.priv[0]);
+	rebound = true;
+      }
+    }
+    return rebound;
+  }
+  // appends the filled part of the buffers (private or macro's) to rec, after clearing it
+  void Save(std::vector<char> & rec, bool fromUser) const {
+    rec.clear();
+    for (std::size_t i=0; i<fBufs.size(); i++) {
+      Buf const & b = fBufs[i];
+      Int_t n = b.isarray && b.leaf ? std::min(Int_t(b.leaf->GetLen()*b.typesize), Int_t(b.priv.size())) : Int_t(b.priv.size());
+      n = std::max(n, 0);
+      std::size_t at = rec.size();
+      rec.resize(at + sizeof(Int_t) + n);
+      memcpy(&rec[at], &n, sizeof(Int_t));
+      if (n > 0) memcpy(&rec[at + sizeof(Int_t)], fromUser ? b.user : &b.priv[0], n);
+    }
+  }
+  // copies a record back into the buffers (macro's or private)
+  void Load(std::vector<char> const & rec, bool toUser) {
+    std::size_t at = 0;
+    for (std::size_t i=0; i<fBufs.size() && at < rec.size(); i++) {
+      Int_t n;
+      memcpy(&n, &rec[at], sizeof(Int_t));
+      at += sizeof(Int_t);
+      if (n > 0) memcpy(toUser ? fBufs[i].user : &fBufs[i].priv[0], &rec[at], n);
+      at += n;
+    }
+  }
+  std::size_t GetN() const { return fBufs.size(); }
+
+private:
+  struct Buf {
+    TString name;
+    char *user;                 // the macro's buffer
+    std::vector<char> priv;     // the tree's buffer
+    TLeaf *leaf;
+    Int_t typesize;
+    bool isarray;
+  };
+  std::vector<Buf> fBufs;
+
+  // size of one element in memory (Double32_t & Float16_t are Double_t & Float_t there)
+  static Int_t TypeSize(TLeaf *leaf) {
+    TString t = leaf->GetTypeName();
+    if (t == "Double_t" || t == "Double32_t" || t == "Long64_t" || t == "ULong64_t" || t == "Long_t" || t == "ULong_t") return 8;
+    if (t == "Float_t" || t == "Float16_t" || t == "Int_t" || t == "UInt_t") return 4;
+    if (t == "Short_t" || t == "UShort_t") return 2;
+    if (t == "Char_t" || t == "UChar_t" || t == "Bool_t") return 1;
+    return std::max(leaf->GetLenType(), 1);
+  }
+  static std::size_t MaxBytes(Buf const & b) {
+    Int_t n = b.leaf->GetLenStatic();
+    if (b.leaf->GetLeafCount()) n *= std::max(b.leaf->GetLeafCount()->GetMaximum(), 1);
+    return std::size_t(std::max(n, 1)) * b.typesize;
+  }
+};
+
+#endif
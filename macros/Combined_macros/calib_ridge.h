@@ -0,0 +1,106 @@
+#ifndef CALIB_RIDGE_H
+#define CALIB_RIDGE_H
+/*
+  Ridge (Tikhonov) solve of the BBCAL gain fit toward the old gains, instead of the hard Nmin/Min_MB_Ratio
+  cut-off for weakly populated cells. The fit minimizes
+    chi2(c) = sum_ev (sum_i c_i A_i - E)^2/E = c^T M c - 2 B^T c + sum_ev E
+  for the gain ratios c (new/old); the ridge adds lambda*|c - 1|^2, i.e. (M + lambda I) c = B + lambda.
+  Cells w/ plenty of events (M_jj >> lambda) are barely affected, sparse ones are pulled toward their old
+  gain & cells w/o events keep it. lambda is chosen by generalized cross-validation,
+    GCV(lambda) = N chi2(c_lambda) / (N - tr H(lambda))^2,  tr H = sum_k d_k/(d_k + lambda)
+  (N: # calibration events, d_k: eigenvalues of M). M = V D V^T is decomposed once; in the eigenbasis
+  y_k = (b_k + lambda u_k)/(d_k + lambda) (b = V^T B, u = V^T 1), so each lambda costs O(n) & only the
+  chosen one is transformed back (O(n^2)). The constant sum_ev E is part of the run statistics
+  [see calib_run_stats.h]; w/o it (older files) lambda must be given.
+  Usage:
+    CalibRidge rr = SolveRidgeGCV(M, B, sumstats.SumE, sumstats.Ncalibevs, ridge_lambda);   // 0: GCV
+    rr.Print();
+    CoeffR = rr.coeff;
+*/
+
+#include <cmath>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+
+#include "TString.h"
+#include "TVectorD.h"
+#include "TMatrixD.h"
+#include "TMatrixDSym.h"
+#include "TMatrixDSymEigen.h"
+#include "sym_sparse_solver.h"
+
+struct CalibRidge {
+  Double_t lambda;     // chosen (or given) regularisation strength
+  bool bygcv;          // lambda chosen by GCV
+  Double_t gcv;        // its GCV score (0 if not known)
+  Double_t edf;        // effective # fitted gain ratios, tr H
+  Int_t nprior;        // # cells dominated by the prior (M_jj < lambda)
+  TVectorD coeff;      // gain ratios (new/old)
+
+  void Print() const {
+    std::cout << Form(" Ridge solve: lambda = %.4g (%s), GCV = %.6g, effective # parameters = %.1f of %d, "
+		      "%d cell(s) dominated by the old gains", lambda, bygcv ? "GCV" : "given", gcv, edf,
+		      coeff.GetNrows(), nprior) << "\n";
+  }
+};
+
+// lambda > 0: fixed, otherwise the GCV minimum on a log grid of nscan points in [1e-10, 1] x the largest eigenvalue
+inline CalibRidge SolveRidgeGCV(SymSparseMatrix const & M, TVectorD const & B, Double_t sumE, Long64_t nobs,
+				Double_t lambda = 0., Int_t nscan = 200) {
+  Int_t n = M.GetNrows();
+  TMatrixDSym Md(n);
+  for (Int_t i=0; i<n; i++) {
+    SymSparseMatrix::Row const & row = M.GetRow(i);
+    for (std::size_t k=0; k<row.size(); k++) { Md(i, row[k].first) = row[k].second; Md(row[k].first, i) = row[k].second; }
+  }
+  TMatrixDSymEigen eig(Md);
+  TVectorD d = eig.GetEigenValues();
+  TMatrixD const & V = eig.GetEigenVectors();
+  std::vector<Double_t> b(n, 0.), u(n, 0.);
+  for (Int_t k=0; k<n; k++) {
+    if (d(k) < 0.) d(k) = 0.;   // round-off of a positive semi-definite M
+    for (Int_t i=0; i<n; i++) { b[k] += V(i, k)*B(i); u[k] += V(i, k); }
+  }
+
+  // chi2, tr H & GCV for one lambda, all in the eigenbasis
+  bool cangcv = sumE > 0. && nobs > n;
+  auto gcvscore = [&](Double_t lam, Double_t & edf) {
+    Double_t chi2 = sumE;
+    edf = 0.;
+    for (Int_t k=0; k<n; k++) {
+      Double_t y = (b[k] + lam*u[k])/(d(k) + lam);
+      chi2 += d(k)*y*y - 2.*b[k]*y;
+      edf += d(k)/(d(k) + lam);
+    }
+    return cangcv ? nobs*std::max(chi2, 0.)/((nobs - edf)*(nobs - edf)) : 0.;
+  };
+
+  CalibRidge rr;
+  rr.lambda = lambda; rr.bygcv = lambda <= 0.; rr.gcv = 0.; rr.edf = 0.;
+  if (rr.bygcv) {
+    if (!cangcv) {
+      std::cerr << "*!*[ERROR] Ridge: GCV needs the sum of E over the events (run statistics written before it was "
+		<< "stored?) & more events than cells. Give a fixed lambda.\n";
+      std::exit(1);
+    }
+    Double_t dmax = d.Max(), edf;
+    for (Int_t is=0; is<nscan; is++) {
+      Double_t lam = dmax*std::pow(10., -10. + 10.*is/(nscan - 1));
+      Double_t g = gcvscore(lam, edf);
+      if (is == 0 || g < rr.gcv) { rr.lambda = lam; rr.gcv = g; }
+    }
+  }
+  rr.gcv = gcvscore(rr.lambda, rr.edf);
+
+  rr.coeff.ResizeTo(n);
+  for (Int_t k=0; k<n; k++) {
+    Double_t y = (b[k] + rr.lambda*u[k])/(d(k) + rr.lambda);
+    for (Int_t i=0; i<n; i++) rr.coeff(i) += V(i, k)*y;
+  }
+  rr.nprior = 0;
+  for (Int_t j=0; j<n; j++) if (M(j, j) < rr.lambda) rr.nprior++;
+  return rr;
+}
+
+#endif
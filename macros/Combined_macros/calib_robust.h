@@ -0,0 +1,138 @@
+#ifndef CALIB_ROBUST_H
+#define CALIB_ROBUST_H
+/*
+  Robust (iteratively reweighted) gain fit for the BBCAL energy calibration. The least squares fit
+    chi2(c) = sum_ev (sum_i c_i A_i - E)^2/E
+  gives every event the same say, so radiative tails & the pion/inelastic events left after the W & proton
+  spot cuts pull the gains, more so the more of them there are. IRLS re-solves the fit w/ a weight per event
+  from its E/p residual after calibration, r = sum_i c_i A_i/E - 1, in units of a robust scale
+  s = 1.4826 MAD(r):
+    Huber: w = 1 for |r/s| <= k, k/|r/s| beyond (default k = 1.345)
+    Tukey: w = (1 - (r/s/k)^2)^2 for |r/s| < k, 0 beyond (default k = 4.685)
+  i.e. M = sum_ev w A A^T/E & B = sum_ev w A, starting from the unweighted solution, until the gain ratios
+  change by less than tol (or niter iterations). The calibration events are taken once from the event cache
+  into a compact list (cells w/ energy, their energies & E), so an iteration is a pass over that list & a
+  solve, w/o reading the TChain again.
+  Usage:
+    CalibRobustEvents rev;
+    rev.Add(nhitcell, hitcell, A, E_e);                 // per calibration event (A: dense, by cell)
+    CalibRobust rr = SolveRobust(rev, CoeffR, kRobustHuber, 1.345, 10, 1e-4, solve);   // solve(M, B, sumE, N)
+    rr.Print();
+*/
+
+#include <cmath>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#include "TString.h"
+#include "TVectorD.h"
+#include "sym_sparse_solver.h"
+
+enum { kRobustHuber = 1, kRobustTukey = 2 };
+
+// calibration events: cells w/ energy & their energies (concatenated), E
+struct CalibRobustEvents {
+  std::vector<Long64_t> first;   // index of the 1st cell of every event in cell & a, plus the end
+  std::vector<Int_t> cell;
+  std::vector<Double_t> a;
+  std::vector<Double_t> E;
+
+  CalibRobustEvents() : first(1, 0) {}
+  void Add(Int_t n, Int_t const * cells, Double_t const * A, Double_t e) {
+    for (Int_t k=0; k<n; k++) { cell.push_back(cells[k]); a.push_back(A[cells[k]]); }
+    first.push_back(cell.size());
+    E.push_back(e);
+  }
+  Long64_t GetN() const { return E.size(); }
+  Double_t GetMemMB() const {
+    return (first.capacity()*sizeof(Long64_t) + cell.capacity()*sizeof(Int_t) + (a.capacity() + E.capacity())*sizeof(Double_t))/1048576.;
+  }
+};
+
+inline Double_t RobustWeight(Double_t u, Int_t kind, Double_t k) {
+  Double_t au = fabs(u);
+  if (kind == kRobustTukey) return au < k ? pow(1. - (u/k)*(u/k), 2) : 0.;
+  return au <= k ? 1. : k/au;
+}
+
+struct CalibRobust {
+  Int_t kind;
+  Double_t k;
+  Int_t niter;              // iterations done
+  bool converged;
+  Double_t scale;           // robust scale of the E/p residuals (last iteration)
+  Double_t fdown, fzero;    // fraction of the events w/ weight < 1 & w/ weight 0
+  Double_t sumw;            // effective # events
+  Double_t maxdc;           // largest change of a gain ratio in the last iteration
+  Double_t time;            // s, all iterations
+
+  void Print() const {
+    std::cout << Form(" Robust fit (%s, k = %.3g): %d iteration(s)%s, max. change of a gain ratio %.2g, E/p scale %.4f, "
+		      "%.1f%% of the events down-weighted (%.1f%% to 0), effective # events %.0f, %.3f s",
+		      kind == kRobustTukey ? "Tukey" : "Huber", k, niter, converged ? "" : " (not converged)", maxdc,
+		      scale, 100.*fdown, 100.*fzero, sumw, time) << "\n";
+  }
+};
+
+// IRLS from the unweighted gain ratios coeff (updated). solve(M, B, sumE, nobs) returns the gain ratios of a
+// weighted system (masking of bad cells etc. is up to it); cells it keeps at 1 don't count for the convergence.
+template<class S>
+CalibRobust SolveRobust(CalibRobustEvents const & ev, TVectorD & coeff, Int_t kind, Double_t k, Int_t maxiter,
+			Double_t tol, S solve) {
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  Int_t n = coeff.GetNrows();
+  Long64_t N = ev.GetN();
+  CalibRobust rr;
+  rr.kind = kind; rr.k = k; rr.niter = 0; rr.converged = false;
+  rr.scale = 0.; rr.fdown = rr.fzero = 0.; rr.sumw = N; rr.maxdc = 0.;
+  std::vector<Double_t> r(N), tmp(N), A(n, 0.);
+  SymSparseMatrix M(n);   // its pattern is built in the 1st iteration, later ones only add to it
+  for (Int_t it=0; it<maxiter && N > 0; it++) {
+    // residuals & their robust scale
+    for (Long64_t i=0; i<N; i++) {
+      Double_t e = 0.;
+      for (Long64_t q=ev.first[i]; q<ev.first[i+1]; q++) e += coeff(ev.cell[q])*ev.a[q];
+      r[i] = e/ev.E[i] - 1.;
+    }
+    tmp = r;
+    std::nth_element(tmp.begin(), tmp.begin() + N/2, tmp.end());
+    Double_t med = tmp[N/2];
+    for (Long64_t i=0; i<N; i++) tmp[i] = fabs(r[i] - med);
+    std::nth_element(tmp.begin(), tmp.begin() + N/2, tmp.end());
+    rr.scale = 1.4826*tmp[N/2];
+    if (rr.scale <= 0.) break;
+
+    // weighted M & B (M keeps its pattern, only the values are reset)
+    M.ZeroValues();
+    TVectorD B(n);
+    Double_t sumE = 0.;
+    Long64_t ndown = 0, nzero = 0;
+    rr.sumw = 0.;
+    for (Long64_t i=0; i<N; i++) {
+      Double_t w = RobustWeight(r[i]/rr.scale, kind, k);
+      if (w < 1.) ndown++;
+      if (w <= 0.) { nzero++; continue; }
+      Int_t nc = ev.first[i+1] - ev.first[i];
+      if (nc == 0) continue;
+      Int_t const * cells = &ev.cell[ev.first[i]];
+      for (Int_t q=0; q<nc; q++) { A[cells[q]] = ev.a[ev.first[i]+q]; B(cells[q]) += w*A[cells[q]]; }
+      M.AddOuter(nc, cells, &A[0], ev.E[i]/w);
+      sumE += w*ev.E[i];
+      rr.sumw += w;
+    }
+    rr.fdown = Double_t(ndown)/N; rr.fzero = Double_t(nzero)/N;
+
+    TVectorD c = solve(M, B, sumE, Long64_t(rr.sumw + 0.5));
+    rr.maxdc = 0.;
+    for (Int_t j=0; j<n; j++) if (c(j) != 1. || coeff(j) != 1.) rr.maxdc = std::max(rr.maxdc, fabs(c(j) - coeff(j)));
+    coeff = c;
+    rr.niter = it+1;
+    if (rr.maxdc < tol) { rr.converged = true; break; }
+  }
+  rr.time = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - t0).count();
+  return rr;
+}
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef CALIB_RUN_SCALE_H
+#define CALIB_RUN_SCALE_H
+/*
+  Joint fit of the BBCAL gain ratios & one energy scale per run (or group of consecutive runs), for long
+  periods w/ run-to-run E/p drifts (beam current, temperature). The fit of calib_run_stats.h becomes
+    chi2(c, f) = sum_g sum_{ev in g} (sum_i c_i A_i - f_g E)^2/E = c^T M c - 2 c^T G f + f^T P f
+  w/ G the n x R matrix of the per-group B vectors & P = diag(sum E per group), all in the run statistics.
+  It is homogeneous in (c, f), so the overall scale is fixed by the p-weighted mean of the f_g being 1.
+  The normal equations have the block structure
+    M c = G f,   P f = G^T c + lambda p   (p = diag(P), lambda: multiplier of the gauge)
+  so c = M^-1 G f w/ the sparse LDL^T of M already used for the gains (one solve per group), leaving the
+  dense R x R Schur complement S = P - G^T M^-1 G for the scales: f = S^-1 p, normalised. chi2 = f^T S f,
+  the usual fit being f = 1. f_g is the p-weighted mean E/p of group g w/ the joint gains (P f = G^T c),
+  i.e. its energy scale; divide its energies by f_g to correct them. Bad cells are left out as in the
+  usual fit & keep ratio 1. Statistical errors of f_g: s^2 (S^-1 - S^-1 p p^T S^-1/p^T S^-1 p)_gg w/
+  s^2 = chi2/(N - # cells - R + 1).
+  Usage:
+    CalibRunScale rsc;
+    rsc.AddRun(rstat);                                    // per run (statistics of the same run add up)
+    if (rsc.Solve(M, ldlt, badCells, nper, CoeffR)) {     // M & ldlt as used for CoeffR, which is replaced
+      rsc.Print(std::cout); rsc.Write(fname);
+    }
+*/
+
+#include <map>
+#include <cmath>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "TString.h"
+#include "TVectorD.h"
+#include "TMatrixDSym.h"
+#include "calib_run_stats.h"
+#include "sym_sparse_solver.h"
+
+class CalibRunScale {
+public:
+  // per group (runs w/o calibration events are left out)
+  std::vector<UInt_t> first, last;          // first & last run
+  std::vector<Int_t> nruns;
+  std::vector<Long64_t> nevents;            // # calibration events
+  std::vector<Double_t> scale, scaleErr;    // f_g & its stat. error
+  std::vector<Double_t> EovP_old, EovP_common;   // p-weighted mean E/p w/ the old gains & w/ the usual fit
+  Double_t chi2, chi2common;                // joint fit & usual fit (f = 1), good cells
+  Long64_t ndf;
+  Double_t time;                            // s
+
+  CalibRunScale() : chi2(0.), chi2common(0.), ndf(0), time(0.) {}
+
+  void AddRun(CalibRunStats const & rs) {
+    if (rs.Ncalibevs <= 0) return;
+    std::map<UInt_t, RunIn>::iterator it = fRuns.find(rs.rnum);
+    if (it == fRuns.end()) {
+      RunIn & r = fRuns[rs.rnum];
+      r.N = rs.Ncalibevs; r.SumE = rs.SumE;
+      r.B.ResizeTo(rs.B.GetNrows()); r.B = rs.B;
+    } else {
+      it->second.N += rs.Ncalibevs; it->second.SumE += rs.SumE; it->second.B += rs.B;
+    }
+  }
+  Int_t GetNruns() const { return fRuns.size(); }
+
+  // M: masked normal matrix (bad cells: identity) & its factorization, nper: # consecutive runs per group.
+  // coeff: gain ratios of the usual fit, replaced by the joint ones. False (coeff kept) if it can't be done.
+  bool Solve(SymSparseMatrix const & M, SymSparseLDLT const & ldlt, std::vector<bool> const & bad, Int_t nper,
+	     TVectorD & coeff) {
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    Int_t n = coeff.GetNrows();
+    if (nper < 1) nper = 1;
+    // groups of consecutive runs (in run number order)
+    std::vector<TVectorD> G;
+    std::vector<Double_t> P;
+    first.clear(); last.clear(); nruns.clear(); nevents.clear();
+    Int_t k = 0;
+    for (std::map<UInt_t, RunIn>::const_iterator it = fRuns.begin(); it != fRuns.end(); ++it, k++) {
+      if (it->second.SumE <= 0.) {
+	std::cerr << "*!*[WARNING] Run scales: no sum of E in the statistics of run " << it->first
+		  << " (older file), rewrite them. Usual fit kept.\n";
+	return false;
+      }
+      if (k % nper == 0) {
+	first.push_back(it->first); nruns.push_back(0); nevents.push_back(0);
+	G.push_back(TVectorD(n)); P.push_back(0.);
+      }
+      last.resize(first.size()); last.back() = it->first;
+      nruns.back()++; nevents.back() += it->second.N;
+      for (Int_t j=0; j<n; j++) if (!bad[j]) G.back()(j) += it->second.B(j);
+      P.back() += it->second.SumE;
+    }
+    Int_t R = G.size();
+    if (R < 2) {
+      std::cerr << "*!*[WARNING] Run scales: " << R << " group(s) of runs w/ calibration events, nothing to fit. Usual fit kept.\n";
+      return false;
+    }
+    // X = M^-1 G (one sparse solve per group), Schur complement S = P - G^T X
+    std::vector<TVectorD> X(R);
+    for (Int_t g=0; g<R; g++) {
+      X[g].ResizeTo(n);
+      X[g] = ldlt.Solve(G[g]);
+      for (Int_t j=0; j<n; j++) if (bad[j]) X[g](j) = 0.;
+    }
+    TMatrixDSym S(R);
+    for (Int_t g=0; g<R; g++)
+      for (Int_t h=0; h<=g; h++) {
+	Double_t s = (g == h ? P[g] : 0.) - Dot(G[g], X[h]);
+	S(g, h) = s; S(h, g) = s;
+      }
+    TMatrixDSym Sinv(S);
+    Double_t det = 0.;
+    Sinv.Invert(&det);
+    if (!(det > 0.)) {
+      std::cerr << "*!*[WARNING] Run scales: singular system (det " << det << "). Usual fit kept.\n";
+      return false;
+    }
+    // f = S^-1 p normalised to sum_g P_g f_g = sum_g P_g
+    std::vector<Double_t> u(R, 0.);
+    Double_t pu = 0., sumP = 0.;
+    for (Int_t g=0; g<R; g++) {
+      for (Int_t h=0; h<R; h++) u[g] += Sinv(g, h)*P[h];
+      pu += P[g]*u[g];
+      sumP += P[g];
+    }
+    scale.assign(R, 0.);
+    for (Int_t g=0; g<R; g++) scale[g] = u[g]*sumP/pu;
+    TVectorD c(n);
+    for (Int_t g=0; g<R; g++) c += scale[g]*X[g];
+    for (Int_t j=0; j<n; j++) if (bad[j]) c(j) = 1.;
+
+    // chi2 w/ the joint & w/ the usual gains, E/p per group
+    chi2 = chi2common = 0.;
+    for (Int_t g=0; g<R; g++)
+      for (Int_t h=0; h<R; h++) { chi2 += scale[g]*S(g, h)*scale[h]; chi2common += S(g, h); }
+    Long64_t N = 0;
+    Int_t ngood = 0;
+    for (Int_t g=0; g<R; g++) N += nevents[g];
+    for (Int_t j=0; j<n; j++) if (!bad[j]) ngood++;
+    ndf = N - ngood - (R - 1);
+    Double_t s2 = ndf > 0 ? chi2/ndf : 0.;
+    scaleErr.assign(R, 0.); EovP_old.assign(R, 0.); EovP_common.assign(R, 0.);
+    for (Int_t g=0; g<R; g++) {
+      scaleErr[g] = sqrt(std::max(s2*(Sinv(g, g) - u[g]*u[g]/pu), 0.));
+      for (Int_t j=0; j<n; j++) {
+	if (bad[j]) continue;
+	EovP_old[g] += G[g](j);
+	EovP_common[g] += coeff(j)*G[g](j);
+      }
+      EovP_old[g] /= P[g]; EovP_common[g] /= P[g];
+    }
+    coeff = c;
+    time = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - t0).count();
+    return true;
+  }
+
+  // one line: # groups, range of the scales, chi2/ndf of the joint fit & w/ common gains only
+  TString GetSummary() const {
+    Int_t R = scale.size();
+    Double_t smin = R > 0 ? *std::min_element(scale.begin(), scale.end()) : 0.;
+    Double_t smax = R > 0 ? *std::max_element(scale.begin(), scale.end()) : 0.;
+    return Form("%d group(s) of runs, scale %.4f - %.4f, chi2/ndf %.4g (joint) vs %.4g (common gains only)",
+		R, smin, smax, ndf > 0 ? chi2/ndf : 0., ndf + R - 1 > 0 ? chi2common/(ndf + R - 1) : 0.);
+  }
+  void Print(std::ostream & out) const {
+    out << " Run scales: " << GetSummary() << Form(", %.3f s", time) << "\n";
+  }
+  // one line per group
+  bool Write(TString const & fname) const {
+    std::ofstream out(fname.Data());
+    if (!out) { std::cerr << "*!*[WARNING] Can't write " << fname << "\n"; return false; }
+    out << "# E/p scale per group of runs from the joint fit w/ the gains (divide the energies of a group by its scale)\n"
+	<< Form("# chi2 %.6g ndf %lld, w/ common gains only %.6g", chi2, ndf, chi2common) << "\n"
+	<< "# first_run last_run nruns ncalibevs scale scale_err EovP_oldgain EovP_commongain\n";
+    for (std::size_t g=0; g<scale.size(); g++)
+      out << first[g] << " " << last[g] << " " << nruns[g] << " " << nevents[g] << " "
+	  << Form("%.6f %.6f %.6f %.6f", scale[g], scaleErr[g], EovP_old[g], EovP_common[g]) << "\n";
+    return true;
+  }
+
+private:
+  struct RunIn {
+    Long64_t N;
+    Double_t SumE;
+    TVectorD B;
+  };
+  std::map<UInt_t, RunIn> fRuns;
+
+  static Double_t Dot(TVectorD const & a, TVectorD const & b) {
+    Double_t s = 0.;
+    for (Int_t j=0; j<a.GetNrows(); j++) s += a(j)*b(j);
+    return s;
+  }
+};
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef CALIB_RUN_STATS_H
+#define CALIB_RUN_STATS_H
+/*
+  Per-run sufficient statistics of the BBCAL energy calibration: the normal matrix M, the vector B,
+  # events per cell and the cut-flow counters. Everything the gain fit needs is additive over runs,
+  so once a run has been processed its statistics can be stored in a small side file and any subset
+  of runs can later be merged & solved w/o reading the ROOT files again [see combine_run_stats.C].
+  A side file is keyed by the run number, a hash of the cut configuration (everything in the
+  configfile which changes M & B) and a hash of the old gain coefficients:
+    <dir>/run<rnum>_cut<cuthash>_gain<gainhash>.txt
+*/
+
+#include <map>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TChain.h"
+#include "TString.h"
+#include "TSystem.h"
+#include "TObjArray.h"
+#include "TObjString.h"
+#include "TChainElement.h"
+#include "sym_sparse_solver.h"
+
+struct CalibRunStats {
+  UInt_t   rnum;
+  TString  gainhash;
+  Long64_t Nevents;      // # events read
+  Long64_t NpassedgCut;  // # events passing global cuts
+  Long64_t Ngoodevs;     // # events passing global & additional cuts
+  Long64_t Nelasevs;     // # events passing elastic cuts on top of that
+  Long64_t Ncalibevs;    // # events entering M & B (i.e. also not on the SH edge)
+  Double_t SumE;         // sum of E over those events, the constant term of the chi2 (0 in older files)
+  SymSparseMatrix M;
+  TVectorD B;
+  std::vector<Int_t> nevents_per_cell;
+  std::vector<Double_t> oldgain; // old gain coeff. per cell (-1000 if not known)
+
+  CalibRunStats(Int_t ncell = 0, UInt_t run = 0) { Reset(ncell, run); }
+  void Reset(Int_t ncell, UInt_t run) {
+    rnum = run; gainhash = "";
+    Nevents = 0; NpassedgCut = 0; Ngoodevs = 0; Nelasevs = 0; Ncalibevs = 0; SumE = 0.;
+    M.ResizeTo(ncell); M.Zero();
+    B.ResizeTo(ncell); B.Zero();
+    nevents_per_cell.assign(ncell, 0);
+    oldgain.assign(ncell, -1000.);
+  }
+  Int_t GetNcell() const { return M.GetNrows(); }
+};
+
+// FNV-1a, good enough to tell configurations apart
+inline ULong64_t CalibHash(char const * str, ULong64_t h = 14695981039346656037ULL) {
+  for (; *str; str++) { h ^= (unsigned char)(*str); h *= 1099511628211ULL; }
+  return h;
+}
+inline TString CalibHashString(ULong64_t h) { return Form("%016llx", h); }
+
+// hash of old gain coefficients (rounded to 9 significant digits, as written in the gain files)
+inline TString GetGainHash(std::vector<Double_t> const & gain) {
+  ULong64_t h = CalibHash("");
+  for (std::size_t i=0; i<gain.size(); i++) h = CalibHash(Form("%.9g ", gain[i]), h);
+  return CalibHashString(h);
+}
+
+// keys which don't change M & B (histogram binning, solver & bookkeeping settings)
+inline bool IsCutNeutralKey(TString const & skey) {
+  if (skey.BeginsWith("h_") || skey.BeginsWith("h2_") || skey.BeginsWith("scan_") || skey.BeginsWith("skim_")) return true;
+  static char const * keys[] = {"macros_dir", "pre_pass", "read_gain", "Min_Event_Per_Channel", "Min_MB_Ratio",
+				"Min_Pivot_Ratio", "check_sparse_accum", "cache_mem_MB", "EovP_fit_width",
+				"write_run_stats", "reuse_run_stats", "nthreads", "diag_hists", "solve_only", "bootstrap", "ridge",
+				"stats_out", "tout_profile", "tout_compression", "tout_baskets",
+				"tree_cache_MB", "unzip_threads", "prefetch_MB", "pipeline", "robust",
+				"auto_cuts", "run_scale", 0};   // auto_cuts: its values enter via GetCutHash's extra
+  for (Int_t i=0; keys[i]; i++) if (skey == keys[i]) return true;
+  return false;
+}
+
+// hash of the cut configuration of a configfile: global cut + every other (relevant) key & its values,
+// w/o comments. The run list doesn't enter & the order of the keys doesn't matter. extra: cut values
+// not in the configfile (e.g. estimated by "auto_cuts" [see calib_auto_cuts.h])
+inline TString GetCutHash(char const * configfilename, TString const & extra = "") {
+  ifstream configfile(configfilename);
+  TString currentline, gcut;
+  std::vector<TString> keylines;
+  while (currentline.ReadLine(configfile) && !currentline.BeginsWith("endRunlist")) {}
+  while (currentline.ReadLine(configfile) && !currentline.BeginsWith("endcut")) {
+    if (!currentline.BeginsWith("#")) gcut += currentline;
+  }
+  while (currentline.ReadLine(configfile)) {
+    if (currentline.BeginsWith("#")) continue;
+    TObjArray *tokens = currentline.Tokenize(" \t");
+    Int_t ntokens = tokens->GetEntries();
+    if (ntokens>1) {
+      TString skey = ((TObjString*)(*tokens)[0])->GetString();
+      if (skey == "*****") { delete tokens; break; }
+      // sampled statistics are kept apart from full ones, "sample 0 0 ..." (off) doesn't count
+      bool sampleoff = skey == "sample" && ((TObjString*)(*tokens)[1])->GetString().Atoll() <= 0 &&
+	(ntokens < 3 || ((TObjString*)(*tokens)[2])->GetString().BeginsWith("#") || ((TObjString*)(*tokens)[2])->GetString().Atoll() <= 0);
+      if (!IsCutNeutralKey(skey) && !sampleoff) {
+	TString line = skey;
+	for (Int_t i=1; i<ntokens; i++) {
+	  TString tok = ((TObjString*)(*tokens)[i])->GetString();
+	  if (tok.BeginsWith("#")) break;
+	  line += " " + tok;
+	}
+	keylines.push_back(line);
+      }
+    }
+    delete tokens;
+  }
+  std::sort(keylines.begin(), keylines.end());
+  ULong64_t h = CalibHash(gcut.ReplaceAll(" ","").Data());
+  for (std::size_t i=0; i<keylines.size(); i++) h = CalibHash(Form(";%s", keylines[i].Data()), h);
+  if (extra != "") h = CalibHash(Form(";%s", extra.Data()), h);
+  return CalibHashString(h);
+}
+
+inline TString GetRunStatsFileName(TString const & dir, UInt_t rnum, TString const & cuthash, TString const & gainhash) {
+  return Form("%s/run%u_cut%s_gain%s.txt", dir.Data(), rnum, cuthash.Data(), gainhash.Data());
+}
+
+// finds the side file of a run; w/ an empty gainhash any gain hash is accepted as long as it is unique
+inline TString FindRunStatsFile(TString const & dir, UInt_t rnum, TString const & cuthash, TString const & gainhash) {
+  if (gainhash != "") {
+    TString fname = GetRunStatsFileName(dir, rnum, cuthash, gainhash);
+    return gSystem->AccessPathName(fname) ? "" : fname;
+  }
+  TString prefix = Form("run%u_cut%s_gain", rnum, cuthash.Data()), found;
+  Int_t nfound = 0;
+  void *dirp = gSystem->OpenDirectory(dir);
+  if (!dirp) return "";
+  while (char const * entry = gSystem->GetDirEntry(dirp)) {
+    TString sentry = entry;
+    if (sentry.BeginsWith(prefix) && sentry.EndsWith(".txt")) { found = dir + "/" + sentry; nfound++; }
+  }
+  gSystem->FreeDirectory(dirp);
+  if (nfound > 1) {
+    std::cout << "*!*[WARNING] Run " << rnum << " has statistics w/ " << nfound << " different old gains in "
+	      << dir << ". Not reusing any of them.\n";
+    return "";
+  }
+  return found;
+}
+
+// the text format of the side files, also used for the statistics in shard files [see calib_shard.h]
+inline bool WriteRunStats(std::ostream & out, CalibRunStats const & rs, TString const & cuthash) {
+  Int_t n = rs.GetNcell();
+  out << "# BBCAL energy calibration sufficient statistics (lower triangle of M)\n";
+  out << "run " << rs.rnum << "\ncut_hash " << cuthash << "\ngain_hash " << rs.gainhash << "\nncell " << n << "\n";
+  out << "cutflow " << rs.Nevents << " " << rs.NpassedgCut << " " << rs.Ngoodevs << " "
+      << rs.Nelasevs << " " << rs.Ncalibevs << "\n";
+  out << "sum_E " << Form("%.17g", rs.SumE) << "\n";
+  out << "nevents_per_cell";
+  for (Int_t i=0; i<n; i++) out << " " << rs.nevents_per_cell[i];
+  out << "\nold_gain";
+  for (Int_t i=0; i<n; i++) out << " " << Form("%.9g", rs.oldgain[i]);
+  out << "\nB";
+  for (Int_t i=0; i<n; i++) out << " " << Form("%.17g", rs.B(i));
+  out << "\nM " << rs.M.GetNonZeros() << "\n";
+  for (Int_t i=0; i<n; i++) {
+    SymSparseMatrix::Row const & row = rs.M.GetRow(i);
+    for (std::size_t k=0; k<row.size(); k++) out << i << " " << row[k].first << " " << Form("%.17g", row[k].second) << "\n";
+  }
+  out << "end\n";
+  return out.good();
+}
+
+inline bool WriteRunStats(TString const & fname, CalibRunStats const & rs, TString const & cuthash) {
+  ofstream out(fname.Data());
+  if (!out.is_open()) {
+    std::cerr << "*!*[WARNING] Could not write run statistics to " << fname << "\n";
+    return false;
+  }
+  return WriteRunStats(out, rs, cuthash);
+}
+
+// false if the statistics are incomplete (up to the "end" line)
+inline bool ReadRunStats(std::istream & in, CalibRunStats & rs) {
+  std::string key, line;
+  Int_t n = 0;
+  while (in >> key) {
+    if (key[0] == '#') { std::getline(in, line); continue; }
+    if (key == "run") in >> rs.rnum;
+    else if (key == "cut_hash") in >> line;
+    else if (key == "gain_hash") { in >> line; rs.gainhash = line.c_str(); }
+    else if (key == "ncell") { in >> n; UInt_t r = rs.rnum; TString g = rs.gainhash; rs.Reset(n, r); rs.gainhash = g; }
+    else if (key == "cutflow") in >> rs.Nevents >> rs.NpassedgCut >> rs.Ngoodevs >> rs.Nelasevs >> rs.Ncalibevs;
+    else if (key == "sum_E") in >> rs.SumE;
+    else if (key == "nevents_per_cell") for (Int_t i=0; i<n; i++) in >> rs.nevents_per_cell[i];
+    else if (key == "old_gain") for (Int_t i=0; i<n; i++) in >> rs.oldgain[i];
+    else if (key == "B") for (Int_t i=0; i<n; i++) in >> rs.B(i);
+    else if (key == "M") {
+      Long64_t nnz = 0; in >> nnz;
+      for (Long64_t k=0; k<nnz; k++) { Int_t i, j; Double_t v; in >> i >> j >> v; rs.M.Add(i, j, v); }
+    }
+    else if (key == "end") return n > 0 && !in.fail();
+  }
+  return false;
+}
+
+inline bool ReadRunStats(TString const & fname, CalibRunStats & rs) {
+  ifstream in(fname.Data());
+  if (!in.is_open()) return false;
+  if (ReadRunStats(in, rs)) return true;
+  std::cerr << "*!*[WARNING] Incomplete run statistics file " << fname << "\n";
+  return false;
+}
+
+// sum += rs. Old gains of cells unknown so far are taken over, conflicting ones are counted & returned.
+inline Int_t AddRunStats(CalibRunStats & sum, CalibRunStats const & rs) {
+  sum.Nevents += rs.Nevents; sum.NpassedgCut += rs.NpassedgCut;
+  sum.Ngoodevs += rs.Ngoodevs; sum.Nelasevs += rs.Nelasevs; sum.Ncalibevs += rs.Ncalibevs;
+  sum.SumE += rs.SumE;
+  sum.M.Add(rs.M);
+  sum.B += rs.B;
+  Int_t nconflict = 0;
+  for (Int_t i=0; i<sum.GetNcell(); i++) {
+    sum.nevents_per_cell[i] += rs.nevents_per_cell[i];
+    if (rs.oldgain[i] == -1000.) continue;
+    if (sum.oldgain[i] == -1000.) sum.oldgain[i] = rs.oldgain[i];
+    else if (fabs(sum.oldgain[i] - rs.oldgain[i]) > 1e-6*fabs(rs.oldgain[i])) nconflict++;
+  }
+  return nconflict;
+}
+
+// run number (from the first event) & # entries of a replayed ROOT file
+inline UInt_t GetFileRunNumber(TString const & fname, Long64_t * nentries = 0) {
+  UInt_t rnum = 0;
+  if (nentries) *nentries = 0;
+  TFile *f = TFile::Open(fname);
+  if (!f || f->IsZombie()) { delete f; return 0; }
+  TTree *T = (TTree*)f->Get("T");
+  if (T && nentries) *nentries = T->GetEntries();
+  if (T && T->GetEntries() > 0) {
+    T->SetBranchStatus("*", 0);
+    T->SetBranchStatus("fEvtHdr.fRun", 1);
+    T->SetBranchAddress("fEvtHdr.fRun", &rnum);
+    T->GetEntry(0);
+  }
+  f->Close();
+  delete f;
+  return rnum;
+}
+
+// expands a run list entry (may contain wildcards) into file names
+inline std::vector<TString> ExpandRootFiles(TString const & pattern) {
+  std::vector<TString> files;
+  TChain tmp("T");
+  tmp.Add(pattern);
+  TObjArray *fl = tmp.GetListOfFiles();
+  for (Int_t i=0; i<fl->GetEntries(); i++) files.push_back(((TChainElement*)fl->At(i))->GetTitle());
+  return files;
+}
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef CALIB_SHARD_H
+#define CALIB_SHARD_H
+/*
+  Process-level sharding of the BBCAL energy calibration. n independent jobs (local processes or batch
+  jobs, w/ any # threads each) read one slice of the files of the run list each & stop after the 1st
+  loop. The slices come from PartitionFiles over all the files, so every job agrees on them & on the
+  run indices. A shard writes everything the rest of the job needs to its shard file:
+    - the histograms filled in the 1st loop & the run-indexed accumulators [see bbcal_run_hist.h]
+    - Tout
+    - the per-run statistics (& bootstrap chunks) in the text format of the side files, i.e. exact
+    - the event caches of its workers [see calib_event_cache.h], the counters, the dense check (if on),
+      the run list & the runs w/ reused statistics
+  The merge job loads shard i into worker i & carries on as after a multi-threaded loop: merge in worker
+  (= shard) order, solve, 2nd loop over the event cache, plots. All shards & the merge must use the same
+  configfile (checked via the cut hash) & the same build of the macros (the cache records are raw memory).
+  Usage:
+    bbcal_eng_calib_w_h2("cfg", 1, i, n);     // shard i of n, 0 <= i < n
+    bbcal_eng_calib_w_h2("cfg", 1, -1, n);    // merge of the n shard files
+*/
+
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <iostream>
+
+#include "TH1.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TString.h"
+#include "TMatrixD.h"
+#include "TVectorD.h"
+#include "TObjString.h"
+#include "calib_parallel.h"
+
+inline TString GetShardTag(Int_t ishard, Int_t nshards) { return Form("_shard%dof%d", ishard, nshards); }
+
+// what a shard tells the merge besides the contents of its worker
+struct CalibShardInfo {
+  Double_t realtime, cputime;            // of the shard's event loop (all its threads)
+  std::vector<std::string> lrnum;        // list of run numbers (all shards)
+  std::map<UInt_t, TString> reusedRuns;  // runs w/ reused statistics (all shards)
+};
+
+enum { kShardIshard, kShardNshards, kShardNgoodevs, kShardNelasevs, kShardNprocessed, kShardRealtime, kShardCputime,
+       kShardNchunks, kShardEvSize, kShardBlkSize, kShardNinfo };
+
+// writes the merged state of a shard job to f (which already holds Tout)
+inline void WriteCalibShard(TFile *f, Int_t ishard, Int_t nshards, TString const & cuthash,
+			    std::vector<TH1*> const & hists, std::vector<BBRunHist*> const & runhists, TTree *Tout,
+			    std::map<UInt_t, CalibRunStats> const & runstats, std::vector<CalibRunStats> const & bootstats,
+			    std::vector<CalibWorker*> const & workers, TMatrixD const & M_chk, TVectorD const & B_chk,
+			    Long64_t Ngoodevs, Long64_t Nelasevs, Long64_t Nprocessed, CalibShardInfo const & info) {
+  f->cd();
+  for (std::size_t i=0; i<hists.size(); i++) f->WriteTObject(hists[i], hists[i]->GetName(), "Overwrite");
+  for (std::size_t i=0; i<runhists.size(); i++) {
+    TMatrixD s = runhists[i]->GetState();
+    f->WriteTObject(&s, runhists[i]->GetName() + "_state", "Overwrite");
+  }
+  if (Tout) Tout->Write("", TObject::kOverwrite);
+
+  std::ostringstream os, osboot, osruns, osreused;
+  for (std::map<UInt_t, CalibRunStats>::const_iterator it = runstats.begin(); it != runstats.end(); ++it)
+    WriteRunStats(os, it->second, cuthash);
+  for (std::size_t i=0; i<bootstats.size(); i++) WriteRunStats(osboot, bootstats[i], cuthash);
+  for (std::size_t i=0; i<info.lrnum.size(); i++) osruns << info.lrnum[i] << " ";
+  for (std::map<UInt_t, TString>::const_iterator it = info.reusedRuns.begin(); it != info.reusedRuns.end(); ++it)
+    osreused << it->first << " " << it->second << "\n";
+  TObjString(cuthash).Write("shard_cut_hash", TObject::kOverwrite);
+  TObjString(os.str().c_str()).Write("shard_runstats", TObject::kOverwrite);
+  TObjString(osboot.str().c_str()).Write("shard_bootstats", TObject::kOverwrite);
+  TObjString(osruns.str().c_str()).Write("shard_runs", TObject::kOverwrite);
+  TObjString(osreused.str().c_str()).Write("shard_reused_runs", TObject::kOverwrite);
+  if (M_chk.GetNrows() > 0) { f->WriteTObject(&M_chk, "shard_M_chk", "Overwrite"); f->WriteTObject(&B_chk, "shard_B_chk", "Overwrite"); }
+
+  Long64_t nchunks = 0;
+  for (std::size_t iw=0; iw<workers.size(); iw++) nchunks += workers[iw]->evcache.Write(f, "shard_evcache", nchunks);
+
+  TVectorD v(kShardNinfo);
+  v(kShardIshard) = ishard; v(kShardNshards) = nshards;
+  v(kShardNgoodevs) = Ngoodevs; v(kShardNelasevs) = Nelasevs; v(kShardNprocessed) = Nprocessed;
+  v(kShardRealtime) = info.realtime; v(kShardCputime) = info.cputime;
+  v(kShardNchunks) = nchunks; v(kShardEvSize) = sizeof(CalibEvRecord); v(kShardBlkSize) = sizeof(CalibBlkRecord);
+  f->WriteTObject(&v, "shard_info", "Overwrite");
+}
+
+// loads shard file fname (shard ishard of nshards) into worker w, which keeps the file open for its Tout
+inline void ReadCalibShard(TString const & fname, Int_t ishard, Int_t nshards, TString const & cuthash,
+			   std::vector<TH1*> const & hists, std::vector<BBRunHist*> const & runhists,
+			   CalibWorker & w, CalibShardInfo & info) {
+  TFile *f = TFile::Open(fname);
+  if (!f || f->IsZombie()) {
+    std::cerr << "*!*[ERROR] Could not open shard file " << fname << "\n";
+    std::exit(1);
+  }
+  TVectorD *v = 0;
+  TObjString *shash = 0;
+  f->GetObject("shard_info", v);
+  f->GetObject("shard_cut_hash", shash);
+  if (!v || !shash || v->GetNrows() != kShardNinfo) {
+    std::cerr << "*!*[ERROR] " << fname << " is not a complete shard file (shard job failed?)\n";
+    std::exit(1);
+  }
+  if (Int_t((*v)(kShardIshard)) != ishard || Int_t((*v)(kShardNshards)) != nshards || shash->GetString() != cuthash) {
+    std::cerr << "*!*[ERROR] " << fname << " is shard " << (*v)(kShardIshard) << " of " << (*v)(kShardNshards)
+	      << " w/ cut hash " << shash->GetString() << ", expected " << ishard << " of " << nshards << " w/ " << cuthash << "\n";
+    std::exit(1);
+  }
+  if (Int_t((*v)(kShardEvSize)) != Int_t(sizeof(CalibEvRecord)) || Int_t((*v)(kShardBlkSize)) != Int_t(sizeof(CalibBlkRecord))) {
+    std::cerr << "*!*[ERROR] Event cache records of " << fname << " come from another build of the macros\n";
+    std::exit(1);
+  }
+
+  for (std::size_t i=0; i<hists.size(); i++) {
+    TH1 *h = 0;
+    f->GetObject(hists[i]->GetName(), h);
+    if (!h) {
+      std::cerr << "*!*[ERROR] Histogram " << hists[i]->GetName() << " missing in " << fname << " (other diag_hists?)\n";
+      std::exit(1);
+    }
+    w.Hist<TH1>(hists[i]->GetName())->Add(h);
+    delete h;
+  }
+  for (std::size_t i=0; i<runhists.size(); i++) {
+    TMatrixD *s = 0;
+    f->GetObject(runhists[i]->GetName() + "_state", s);
+    if (!s) {
+      std::cerr << "*!*[ERROR] Run histogram " << runhists[i]->GetName() << " missing in " << fname << "\n";
+      std::exit(1);
+    }
+    w.RunHist(runhists[i]->GetName())->AddState(*s);
+    delete s;
+  }
+  f->GetObject("Tout", w.Tout);
+
+  TObjString *sstats = 0, *sboot = 0, *sruns = 0, *sreused = 0;
+  f->GetObject("shard_runstats", sstats);
+  f->GetObject("shard_bootstats", sboot);
+  f->GetObject("shard_runs", sruns);
+  f->GetObject("shard_reused_runs", sreused);
+  if (!sstats || !sboot || !sruns || !sreused) {
+    std::cerr << "*!*[ERROR] Run statistics missing in " << fname << "\n";
+    std::exit(1);
+  }
+  std::istringstream is(sstats->GetString().Data()), isboot(sboot->GetString().Data());
+  CalibRunStats rs;   // reset by every "ncell" line
+  while (ReadRunStats(is, rs)) w.runstats.insert(std::make_pair(rs.rnum, rs));   // copy, TVectorD assignment needs equal sizes
+  while (ReadRunStats(isboot, rs)) w.bootstats.push_back(rs);
+  std::istringstream isruns(sruns->GetString().Data()), isreused(sreused->GetString().Data());
+  std::string srun;
+  info.lrnum.clear();
+  while (isruns >> srun) info.lrnum.push_back(srun);
+  info.reusedRuns.clear();
+  UInt_t rnum; std::string sfile;
+  while (isreused >> rnum >> sfile) info.reusedRuns[rnum] = sfile.c_str();
+
+  if (w.M_chk.GetNrows() > 0) {
+    TMatrixD *m = 0;
+    TVectorD *b = 0;
+    f->GetObject("shard_M_chk", m);
+    f->GetObject("shard_B_chk", b);
+    if (!m || !b || m->GetNrows() != w.M_chk.GetNrows()) {
+      std::cerr << "*!*[ERROR] Dense check matrix missing in " << fname << " (check_sparse_accum off in the shard?)\n";
+      std::exit(1);
+    }
+    w.M_chk += *m; w.B_chk += *b;
+    delete m; delete b;
+  }
+
+  w.evcache.Read(f, "shard_evcache", 0, Long64_t((*v)(kShardNchunks)));
+  w.Ngoodevs = Long64_t((*v)(kShardNgoodevs)); w.Nelasevs = Long64_t((*v)(kShardNelasevs));
+  w.Nprocessed = Long64_t((*v)(kShardNprocessed));
+  info.realtime = (*v)(kShardRealtime); info.cputime = (*v)(kShardCputime);
+  w.realtime = info.realtime; w.cputime = info.cputime;
+  delete v; delete shash; delete sstats; delete sboot; delete sruns; delete sreused;
+  w.fshard = f;
+}
+
+#endif
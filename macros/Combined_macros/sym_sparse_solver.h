@@ -0,0 +1,357 @@
+#ifndef SYM_SPARSE_SOLVER_H
+#define SYM_SPARSE_SOLVER_H
+/*
+  Sparse storage and direct solver for the normal equations (M * c = B) of the calorimeter
+  gain calibrations. M is symmetric positive definite and, since a cluster only couples
+  neighbouring blocks, very sparse:
+  - SymSparseMatrix : lower triangle of M, one sorted (col, value) list per row. It is filled
+                      event by event with the outer product of the cells touched by the cluster.
+  - SymSparseLDLT   : LDL^T factorization of M in envelope (skyline) storage. The cells are first
+                      renumbered with reverse Cuthill-McKee so that the SH row-major band and the
+                      SH <-> PS coupling block stay narrow. Instead of the explicit inverse we get
+                      the condition number and the pivots D_ii/M_ii, which flag numerically
+                      degenerate cells (e.g. two blocks that always fire together).
+  Usage:
+    SymSparseMatrix M(ncell);
+    M.AddOuter(nhit, hitIDs, A, E_e);    // per event: M(i,j) += A[i]*A[j]/E_e
+    SymSparseLDLT ldlt(M);
+    TVectorD CoeffR = ldlt.Solve(B);
+*/
+
+#include <cmath>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+
+#include "TMatrixD.h"
+#include "TVectorD.h"
+
+class SymSparseMatrix {
+public:
+  typedef std::pair<Int_t,Double_t> Entry;  // (column, value)
+  typedef std::vector<Entry> Row;
+
+  SymSparseMatrix(Int_t n = 0) : fN(n), fRows(n) {}
+
+  Int_t GetNrows() const { return fN; }
+  Row const & GetRow(Int_t i) const { return fRows[i]; }
+
+  // sets all elements to zero (keeps the dimension)
+  void Zero() { for (Int_t i=0; i<fN; i++) fRows[i].clear(); }
+  void Clear() { fN = 0; fRows.clear(); }
+  // sets the stored elements to zero, keeping them (refilling w/ the same pattern inserts nothing)
+  void ZeroValues() { for (Int_t i=0; i<fN; i++) for (std::size_t k=0; k<fRows[i].size(); k++) fRows[i][k].second = 0.; }
+  void ResizeTo(Int_t n) { fN = n; fRows.assign(n, Row()); }
+
+  // # stored elements of the lower triangle (incl. diagonal)
+  Long64_t GetNonZeros() const {
+    Long64_t nnz = 0;
+    for (Int_t i=0; i<fN; i++) nnz += fRows[i].size();
+    return nnz;
+  }
+
+  // returns M(i,j) (= M(j,i)), zero if not stored
+  Double_t operator()(Int_t i, Int_t j) const {
+    if (i < j) std::swap(i, j);
+    Row const & r = fRows[i];
+    Row::const_iterator it = std::lower_bound(r.begin(), r.end(), j, ColLess());
+    return (it != r.end() && it->first == j) ? it->second : 0.;
+  }
+
+  // M(i,j) += v (and M(j,i), only one of them is stored)
+  void Add(Int_t i, Int_t j, Double_t v) {
+    if (i < j) std::swap(i, j);
+    Row & r = fRows[i];
+    Row::iterator it = std::lower_bound(r.begin(), r.end(), j, ColLess());
+    if (it != r.end() && it->first == j) it->second += v;
+    else r.insert(it, Entry(j, v));
+  }
+
+  // M(i,j) += A[i]*A[j]/norm for all pairs of the n cells listed in ids. Same arithmetic,
+  // element by element, as the dense double loop over all cells.
+  void AddOuter(Int_t n, Int_t const * ids, Double_t const * A, Double_t norm) {
+    for (Int_t a=0; a<n; a++) {
+      Int_t i = ids[a];
+      for (Int_t b=0; b<=a; b++) {
+	Int_t j = ids[b];
+	Add(i, j, A[i]*A[j]/norm);
+      }
+    }
+  }
+
+  // M += w*other (same dimension)
+  void Add(SymSparseMatrix const & other, Double_t w = 1.) {
+    for (Int_t i=0; i<fN; i++) {
+      Row const & r = other.fRows[i];
+      for (std::size_t k=0; k<r.size(); k++) Add(i, r[k].first, w*r[k].second);
+    }
+  }
+
+  // takes cell j out of the system: M(j,k) = M(k,j) = 0 for k != j, M(j,j) = 1
+  void MaskCell(Int_t j) {
+    fRows[j].assign(1, Entry(j, 1.));
+    for (Int_t i=j+1; i<fN; i++) {
+      Row & r = fRows[i];
+      Row::iterator it = std::lower_bound(r.begin(), r.end(), j, ColLess());
+      if (it != r.end() && it->first == j) r.erase(it);
+    }
+  }
+
+  // y = M*x
+  void Mult(Double_t const * x, Double_t * y) const {
+    for (Int_t i=0; i<fN; i++) y[i] = 0.;
+    for (Int_t i=0; i<fN; i++) {
+      Row const & r = fRows[i];
+      for (std::size_t k=0; k<r.size(); k++) {
+	Int_t j = r[k].first;
+	y[i] += r[k].second*x[j];
+	if (j != i) y[j] += r[k].second*x[i];
+      }
+    }
+  }
+
+  TMatrixD GetDense() const {
+    TMatrixD Md(fN, fN);
+    for (Int_t i=0; i<fN; i++) {
+      Row const & r = fRows[i];
+      for (std::size_t k=0; k<r.size(); k++) {
+	Md(i, r[k].first) = r[k].second;
+	Md(r[k].first, i) = r[k].second;
+      }
+    }
+    return Md;
+  }
+
+private:
+  struct ColLess {
+    bool operator()(Entry const & e, Int_t col) const { return e.first < col; }
+  };
+  Int_t fN;
+  std::vector<Row> fRows;
+};
+
+
+class SymSparseLDLT {
+public:
+  SymSparseLDLT() : fN(0), fNbad(0), fLmax(0.), fLmin(0.) {}
+
+  // factorizes M; pivots with D_ii <= pivtol*M_ii are counted as non-positive
+  SymSparseLDLT(SymSparseMatrix const & M, Double_t pivtol = 1e-14)
+    : fN(M.GetNrows()), fNbad(0), fLmax(0.), fLmin(0.)
+  {
+    Order(M);
+    Factorize(M, pivtol);
+    EstimateCondition(M);
+  }
+
+  Int_t GetNrows() const { return fN; }
+  // true if all pivots were positive, i.e. M is numerically positive definite
+  bool IsValid() const { return fN > 0 && fNbad == 0; }
+  Int_t GetNbadPivots() const { return fNbad; }
+  // # stored elements of L (envelope) vs. the dense lower triangle
+  Long64_t GetEnvelopeSize() const { return fL.size(); }
+  Int_t GetBandwidth() const {
+    Int_t bw = 0;
+    for (Int_t k=0; k<fN; k++) bw = std::max(bw, k-fFirst[k]);
+    return bw;
+  }
+  // 2-norm condition number estimate lambda_max/lambda_min
+  Double_t GetCondition() const { return fLmin > 0. ? fLmax/fLmin : -1.; }
+  Double_t GetLambdaMax() const { return fLmax; }
+  Double_t GetLambdaMin() const { return fLmin; }
+  // D_ii/M_ii of a cell (original numbering); ~1 for a well determined cell, -> 0 if the
+  // cell is (nearly) a linear combination of the cells eliminated before it
+  Double_t GetPivotRatio(Int_t cell) const { return fRatio[fIperm[cell]]; }
+
+  // cells (original numbering) w/ pivot ratio below minratio, smallest first
+  std::vector<Int_t> GetSmallPivotCells(Double_t minratio) const {
+    std::vector<Int_t> cells;
+    std::vector<Int_t> order = GetPivotOrder();
+    for (std::size_t k=0; k<order.size(); k++)
+      if (GetPivotRatio(order[k]) < minratio) cells.push_back(order[k]);
+    return cells;
+  }
+
+  // x = M^-1 b
+  TVectorD Solve(TVectorD const & b) const {
+    std::vector<Double_t> y(fN);
+    for (Int_t k=0; k<fN; k++) y[k] = b(fPerm[k]);
+    SolveInPlace(y);
+    TVectorD x(fN);
+    for (Int_t k=0; k<fN; k++) x(fPerm[k]) = y[k];
+    return x;
+  }
+
+  // prints the numerical diagnostics of the solve
+  void Print(Int_t nsmall = 5) const {
+    std::cout << " Sparse LDL^T: n = " << fN << ", envelope = " << fL.size()
+	      << " (dense lower triangle: " << Long64_t(fN)*(fN-1)/2 << "), bandwidth = "
+	      << GetBandwidth() << "\n";
+    std::cout << "  Condition number ~ " << GetCondition() << " (lambda_max = " << fLmax
+	      << ", lambda_min = " << fLmin << ")\n";
+    if (fNbad) std::cout << "  *!* " << fNbad << " non-positive pivot(s)! Matrix is not positive definite.\n";
+    std::vector<Int_t> order = GetPivotOrder();
+    std::cout << "  Smallest pivots D_ii/M_ii :";
+    for (Int_t k=0; k<nsmall && k<Int_t(order.size()); k++)
+      std::cout << " [cell " << order[k] << "] " << GetPivotRatio(order[k]);
+    std::cout << "\n";
+  }
+
+private:
+  // cells (original numbering) sorted by increasing pivot ratio
+  std::vector<Int_t> GetPivotOrder() const {
+    std::vector<std::pair<Double_t,Int_t> > r(fN);
+    for (Int_t k=0; k<fN; k++) r[k] = std::make_pair(fRatio[k], fPerm[k]);
+    std::sort(r.begin(), r.end());
+    std::vector<Int_t> cells(fN);
+    for (Int_t k=0; k<fN; k++) cells[k] = r[k].second;
+    return cells;
+  }
+
+  // reverse Cuthill-McKee renumbering of the cells -> fPerm (new -> old), fIperm (old -> new)
+  void Order(SymSparseMatrix const & M) {
+    std::vector<std::vector<Int_t> > adj(fN);
+    for (Int_t i=0; i<fN; i++) {
+      SymSparseMatrix::Row const & r = M.GetRow(i);
+      for (std::size_t k=0; k<r.size(); k++) {
+	Int_t j = r[k].first;
+	if (j == i || r[k].second == 0.) continue;
+	adj[i].push_back(j); adj[j].push_back(i);
+      }
+    }
+    std::vector<bool> visited(fN, false);
+    std::vector<Int_t> order; order.reserve(fN);
+    for (;;) {
+      // start each connected component from its lowest degree cell
+      Int_t start = -1;
+      for (Int_t i=0; i<fN; i++)
+	if (!visited[i] && (start < 0 || adj[i].size() < adj[start].size())) start = i;
+      if (start < 0) break;
+      std::size_t head = order.size();
+      visited[start] = true; order.push_back(start);
+      while (head < order.size()) {
+	Int_t i = order[head++];
+	std::vector<std::pair<Int_t,Int_t> > next;
+	for (std::size_t k=0; k<adj[i].size(); k++) {
+	  Int_t j = adj[i][k];
+	  if (!visited[j]) { visited[j] = true; next.push_back(std::make_pair(Int_t(adj[j].size()), j)); }
+	}
+	std::sort(next.begin(), next.end());
+	for (std::size_t k=0; k<next.size(); k++) order.push_back(next[k].second);
+      }
+    }
+    fPerm.assign(order.rbegin(), order.rend());
+    fIperm.resize(fN);
+    for (Int_t k=0; k<fN; k++) fIperm[fPerm[k]] = k;
+  }
+
+  // LDL^T in envelope storage, row by row: for row i and j < i
+  //   w_j = M_ij - sum_k w_k L_jk ,  L_ij = w_j/D_j ,  D_i = M_ii - sum_k w_k L_ik
+  void Factorize(SymSparseMatrix const & M, Double_t pivtol) {
+    // envelope of the permuted matrix
+    fFirst.resize(fN);
+    for (Int_t k=0; k<fN; k++) fFirst[k] = k;
+    for (Int_t i=0; i<fN; i++) {
+      SymSparseMatrix::Row const & r = M.GetRow(i);
+      for (std::size_t k=0; k<r.size(); k++) {
+	if (r[k].second == 0.) continue;
+	Int_t a = fIperm[i], b = fIperm[r[k].first];
+	if (a < b) std::swap(a, b);
+	fFirst[a] = std::min(fFirst[a], b);
+      }
+    }
+    fStart.resize(fN+1);
+    fStart[0] = 0;
+    for (Int_t k=0; k<fN; k++) fStart[k+1] = fStart[k] + (k - fFirst[k]);
+    fL.assign(fStart[fN], 0.);
+    std::vector<Double_t> diag(fN, 0.);
+    for (Int_t i=0; i<fN; i++) {
+      SymSparseMatrix::Row const & r = M.GetRow(i);
+      for (std::size_t k=0; k<r.size(); k++) {
+	Int_t a = fIperm[i], b = fIperm[r[k].first];
+	if (a == b) { diag[a] = r[k].second; continue; }
+	if (a < b) std::swap(a, b);
+	fL[fStart[a] + (b - fFirst[a])] = r[k].second;
+      }
+    }
+    // factorization (fL holds M_ij on input, L_ij on output)
+    fD.assign(fN, 0.); fRatio.assign(fN, 0.);
+    std::vector<Double_t> w(fN, 0.);
+    for (Int_t i=0; i<fN; i++) {
+      Int_t fi = fFirst[i];
+      Long64_t oi = fStart[i] - fi; // fL[oi+j] = L_ij
+      for (Int_t j=fi; j<i; j++) {
+	Int_t kmin = std::max(fi, fFirst[j]);
+	Long64_t oj = fStart[j] - fFirst[j];
+	Double_t s = fL[oi+j];
+	for (Int_t k=kmin; k<j; k++) s -= w[k]*fL[oj+k];
+	w[j] = s;
+      }
+      Double_t d = diag[i];
+      for (Int_t j=fi; j<i; j++) {
+	fL[oi+j] = w[j]/fD[j];
+	d -= w[j]*fL[oi+j];
+      }
+      fRatio[i] = diag[i] > 0. ? d/diag[i] : 0.;
+      if (d <= pivtol*fabs(diag[i]) || diag[i] <= 0.) {
+	// keep going w/ the bare diagonal so that the rest of the diagnostics stay finite
+	fNbad++;
+	d = diag[i] > 0. ? diag[i] : 1.;
+      }
+      fD[i] = d;
+    }
+  }
+
+  // solves L D L^T y = b in the permuted numbering
+  void SolveInPlace(std::vector<Double_t> & y) const {
+    for (Int_t i=0; i<fN; i++) {
+      Long64_t oi = fStart[i] - fFirst[i];
+      Double_t s = y[i];
+      for (Int_t k=fFirst[i]; k<i; k++) s -= fL[oi+k]*y[k];
+      y[i] = s;
+    }
+    for (Int_t i=0; i<fN; i++) y[i] /= fD[i];
+    for (Int_t i=fN-1; i>=0; i--) {
+      Long64_t oi = fStart[i] - fFirst[i];
+      for (Int_t k=fFirst[i]; k<i; k++) y[k] -= fL[oi+k]*y[i];
+    }
+  }
+
+  // lambda_max by power iteration on M, lambda_min by inverse iteration w/ the factors
+  void EstimateCondition(SymSparseMatrix const & M, Int_t maxiter = 100, Double_t tol = 1e-6) {
+    if (fN == 0) return;
+    std::vector<Double_t> x(fN), y(fN), xp(fN);
+    for (Int_t pass=0; pass<2; pass++) {
+      for (Int_t i=0; i<fN; i++) x[i] = 1. + 0.1*sin(Double_t(i));
+      Double_t lambda = 0.;
+      for (Int_t it=0; it<maxiter; it++) {
+	Double_t norm = 0.;
+	for (Int_t i=0; i<fN; i++) norm += x[i]*x[i];
+	norm = sqrt(norm);
+	for (Int_t i=0; i<fN; i++) x[i] /= norm;
+	if (pass == 0) M.Mult(&x[0], &y[0]);
+	else {
+	  for (Int_t k=0; k<fN; k++) xp[k] = x[fPerm[k]];
+	  SolveInPlace(xp);
+	  for (Int_t k=0; k<fN; k++) y[fPerm[k]] = xp[k];
+	}
+	Double_t rq = 0.; // Rayleigh quotient
+	for (Int_t i=0; i<fN; i++) rq += x[i]*y[i];
+	x.swap(y);
+	if (it > 0 && fabs(rq - lambda) <= tol*fabs(rq)) { lambda = rq; break; }
+	lambda = rq;
+      }
+      if (pass == 0) fLmax = lambda;
+      else fLmin = lambda > 0. ? 1./lambda : 0.;
+    }
+  }
+
+  Int_t fN, fNbad;
+  Double_t fLmax, fLmin;
+  std::vector<Int_t> fPerm, fIperm, fFirst;
+  std::vector<Long64_t> fStart;
+  std::vector<Double_t> fL, fD, fRatio;
+};
+
+#endif